@@ -33,7 +33,7 @@ uint32_t BLESerial::onPassKeyRequest() { return bt_passkey_callback(); }
 void BLESerial::onPassKeyNotify(uint32_t passkey) { bt_passkey_notify_callback(passkey); }
 bool BLESerial::onSecurityRequest() { return bt_security_request_callback(); }
 void BLESerial::onAuthenticationComplete(esp_ble_auth_cmpl_t auth_result) { bt_authentication_complete_callback(auth_result); }
-void BLESerial::onConnect(BLEServer *server) { bt_connect_callback(server); }
+void BLESerial::onConnect(BLEServer *server) { peerMTU = 0; maxTransferSize = MIN_TRANSFER_SIZE; transmitBufferLength = 0; bt_connect_callback(server); }
 void BLESerial::onDisconnect(BLEServer *server) { bt_disconnect_callback(server); ble_server->startAdvertising(); }
 bool BLESerial::onConfirmPIN(uint32_t pin) { return bt_confirm_pin_callback(pin); };
 bool BLESerial::connected() { return ble_server->getConnectedCount() > 0; }
@@ -45,9 +45,7 @@ int BLESerial::read() {
 }
 
 size_t BLESerial::readBytes(uint8_t *buffer, size_t bufferSize) {
-  int i = 0;
-  while (i < bufferSize && available()) { buffer[i] = (uint8_t)this->rx_buffer.pop(); i++; }
-  return i;
+  return this->rx_buffer.popBytes(buffer, bufferSize);
 }
 
 int BLESerial::peek() {
@@ -66,8 +64,16 @@ size_t BLESerial::print(const char *str) {
 }
 
 size_t BLESerial::write(const uint8_t *buffer, size_t bufferSize) {
-  if (ble_server->getConnectedCount() <= 0) { return 0; } else {
-    size_t written = 0; for (int i = 0; i < bufferSize; i++) { written += this->write(buffer[i]); }
+  if (!bt_client_authenticated() || ble_server->getConnectedCount() <= 0) { return 0; } else {
+    checkMTU();
+    size_t written = 0;
+    while (written < bufferSize) {
+      size_t span = maxTransferSize - this->transmitBufferLength;
+      if (span > bufferSize - written) { span = bufferSize - written; }
+      memcpy(this->transmitBuffer + this->transmitBufferLength, buffer + written, span);
+      this->transmitBufferLength += span; written += span;
+      if (this->transmitBufferLength >= maxTransferSize) { flush(); }
+    }
     flush();
 
     return written;
@@ -77,9 +83,10 @@ size_t BLESerial::write(const uint8_t *buffer, size_t bufferSize) {
 size_t BLESerial::write(uint8_t byte) {
   if (bt_client_authenticated()) {
     if (ble_server->getConnectedCount() <= 0) { return 0; } else {
+      if (this->transmitBufferLength == 0) { checkMTU(); }
       this->transmitBuffer[this->transmitBufferLength] = byte;
       this->transmitBufferLength++;
-      if (this->transmitBufferLength == maxTransferSize) { flush(); }
+      if (this->transmitBufferLength >= maxTransferSize) { flush(); }
       return 1;
     }
   } else {
@@ -96,6 +103,26 @@ void BLESerial::flush() {
   }
 }
 
+// The MTU exchange completes some time after the
+// connection is set up, so the negotiated value is
+// picked up lazily whenever a new packet is started.
+bool BLESerial::checkMTU() {
+  if (ble_server->getConnectedCount() <= 0) { return false; }
+  uint16_t mtu = ble_server->getPeerMTU(ble_server->getConnId());
+  if (mtu != peerMTU && this->transmitBufferLength == 0) {
+    peerMTU = mtu;
+    size_t transfer_size = mtu > ATT_HEADER_LEN ? mtu - ATT_HEADER_LEN : 0;
+    if (transfer_size < MIN_TRANSFER_SIZE) { transfer_size = MIN_TRANSFER_SIZE; }
+    if (transfer_size > BLE_BUFFER_SIZE) { transfer_size = BLE_BUFFER_SIZE; }
+    maxTransferSize = transfer_size;
+  }
+  return true;
+}
+
+void BLESerial::onConnect(BLEServer *server, esp_ble_gatts_cb_param_t *param) {
+  server->updateConnParams(param->connect.remote_bda, BLE_CONN_INTERVAL_MIN, BLE_CONN_INTERVAL_MAX, 0, BLE_CONN_TIMEOUT);
+}
+
 void BLESerial::disconnect() {
   if (ble_server->getConnectedCount() > 0) {
     uint16_t conn_id = ble_server->getConnId();
@@ -110,6 +137,7 @@ void BLESerial::disconnect() {
 void BLESerial::begin(const char *name) {
   ConnectedDeviceCount = 0;
   BLEDevice::init(name);
+  BLEDevice::setMTU(ATT_MTU_MAX);
 
   esp_ble_tx_power_set(ESP_BLE_PWR_TYPE_DEFAULT, ESP_PWR_LVL_P9); 
   esp_ble_tx_power_set(ESP_BLE_PWR_TYPE_ADV, ESP_PWR_LVL_P9);
@@ -127,8 +155,8 @@ void BLESerial::begin(const char *name) {
 void BLESerial::startAdvertising() {
   ble_adv = BLEDevice::getAdvertising();
   ble_adv->addServiceUUID(BLE_SERIAL_SERVICE_UUID);
-  ble_adv->setMinPreferred(0x20);
-  ble_adv->setMaxPreferred(0x40);
+  ble_adv->setMinPreferred(BLE_CONN_INTERVAL_MIN);
+  ble_adv->setMaxPreferred(BLE_CONN_INTERVAL_MAX);
   ble_adv->setScanResponse(true);
   ble_adv->start();
 }
@@ -141,9 +169,9 @@ void BLESerial::stopAdvertising() {
 void BLESerial::end() { BLEDevice::deinit(); }
 
 void BLESerial::onWrite(BLECharacteristic *characteristic) {
-  if (characteristic->getUUID().toString() == BLE_RX_UUID) {
+  if (characteristic == RxCharacteristic) {
     auto value = characteristic->getValue();
-    for (int i = 0; i < value.length(); i++) { rx_buffer.push(value[i]); }
+    rx_buffer.pushBytes((const uint8_t*)value.c_str(), value.length());
   }
 }
 
@@ -49,6 +49,32 @@ public:
 		}
 	}
 
+	// Bulk push, keeping the same overwrite-oldest
+	// behaviour as push() when the buffer overflows.
+	void pushBytes(const uint8_t *data, size_t len) {
+		if (len >= n) { data += len-(n-1); len = n-1; }
+		size_t length = getLength() + len;
+		while (len > 0) {
+			size_t span = n - head; if (span > len) { span = len; }
+			memcpy(buffer+head, data, span);
+			head = (head + span) % n;
+			data += span; len -= span;
+		}
+		if (length > n-1) { tail = (head + 1) % n; }
+	}
+
+	size_t popBytes(uint8_t *data, size_t len) {
+		size_t length = getLength(); if (len > length) { len = length; }
+		size_t popped = len;
+		while (len > 0) {
+			size_t span = n - tail; if (span > len) { span = len; }
+			memcpy(data, buffer+tail, span);
+			tail = (tail + span) % n;
+			data += span; len -= span;
+		}
+		return popped;
+	}
+
 	void clear() { head = 0; tail = 0; }
 
 	int get(size_t index) {
@@ -71,6 +97,13 @@ public:
 #define RX_BUFFER_SIZE 6144
 #define BLE_BUFFER_SIZE 512 // Must fit in max GATT attribute length
 #define MIN_MTU 50
+#define ATT_MTU_MAX 517     // Largest ATT MTU we will negotiate
+#define ATT_HEADER_LEN 3
+#define ATT_DEFAULT_MTU 23  // Until the peer negotiates a larger one
+#define MIN_TRANSFER_SIZE (ATT_DEFAULT_MTU - ATT_HEADER_LEN)
+#define BLE_CONN_INTERVAL_MIN 6  // 7.5 ms, in 1.25 ms units
+#define BLE_CONN_INTERVAL_MAX 12 // 15 ms
+#define BLE_CONN_TIMEOUT 400     // 4 s, in 10 ms units
 
 class BLESerial : public BLECharacteristicCallbacks, public BLEServerCallbacks, public BLESecurityCallbacks, public Stream {
 public:
@@ -91,6 +124,7 @@ public:
   size_t print(const char *value);
   void flush();
   void onConnect(BLEServer *server);
+  void onConnect(BLEServer *server, esp_ble_gatts_cb_param_t *param);
   void onDisconnect(BLEServer *server);
 
   uint32_t onPassKeyRequest();
@@ -120,8 +154,8 @@ private:
   int ConnectedDeviceCount;
   void SetupSerialService();
 
-  uint16_t peerMTU;
-  uint16_t maxTransferSize = BLE_BUFFER_SIZE;
+  uint16_t peerMTU = 0;
+  uint16_t maxTransferSize = MIN_TRANSFER_SIZE;
 
   bool checkMTU();
 
@@ -52,12 +52,85 @@ char bt_da[BT_DEV_ADDR_LEN];
 char bt_dh[BT_DEV_HASH_LEN];
 char bt_devname[11];
 
+// The pairing PIN is reported to the host by the main
+// loop, since the callbacks that learn it run in the
+// Bluetooth stack's own tasks.
+volatile bool bt_pin_pending = false;
+void loop_wake();
+void bt_indicate_pin() { bt_pin_pending = true; loop_wake(); }
+
 #if MCU_VARIANT == MCU_ESP32
   #if HAS_BLUETOOTH == true
 
+    // Outgoing data is collected per KISS frame and handed
+    // to SPP in MTU sized blocks. While the link reports
+    // congestion, completed frames are held back instead of
+    // blocking in BluetoothSerial, and a frame that no
+    // longer fits is dropped whole. A frame larger than the
+    // buffer is streamed out as it is written, as long as
+    // the link is free when it fills the buffer.
+    #define BT_SPP_MTU ESP_SPP_MAX_MTU
+    #define BT_TX_BUF_SIZE 2048
+    uint8_t bt_tx_buf[BT_TX_BUF_SIZE];
+    uint16_t bt_tx_len = 0;
+    uint16_t bt_tx_frame_start = 0;
+    bool bt_tx_dropping = false;
+    bool bt_tx_streaming = false;
+    volatile bool bt_congested = false;
+
+    void bt_tx_send(bool force = false) {
+      uint16_t sent = 0;
+      while (sent < bt_tx_frame_start && (force || !bt_congested) && bt_state == BT_STATE_CONNECTED) {
+        uint16_t block = bt_tx_frame_start - sent;
+        if (block > BT_SPP_MTU) { block = BT_SPP_MTU; }
+        size_t written = SerialBT.write(bt_tx_buf+sent, block);
+        if (written == 0) { break; }
+        sent += written;
+      }
+      if (bt_state != BT_STATE_CONNECTED) {
+        // Everything buffered is lost with the link. If a
+        // frame was cut off, the rest of it is dropped too,
+        // so it cannot go out as a fragment on the next one.
+        if (bt_tx_streaming || bt_tx_len > bt_tx_frame_start) { bt_tx_dropping = true; }
+        sent = bt_tx_len;
+      }
+      if (sent > 0) {
+        memmove(bt_tx_buf, bt_tx_buf+sent, bt_tx_len-sent);
+        bt_tx_len -= sent;
+        bt_tx_frame_start -= sent < bt_tx_frame_start ? sent : bt_tx_frame_start;
+      }
+    }
+
+    // Called at the end of every KISS frame
+    void bt_flush() {
+      if (bt_tx_dropping) { bt_tx_len = bt_tx_frame_start; bt_tx_dropping = false; }
+      bt_tx_frame_start = bt_tx_len;
+      bt_tx_streaming = false;
+      bt_tx_send();
+    }
+
+    void bt_write(uint8_t byte) {
+      if (bt_tx_dropping) { return; }
+      if (bt_tx_len == BT_TX_BUF_SIZE) { bt_tx_send(); }
+      if (bt_tx_len == BT_TX_BUF_SIZE && (bt_tx_streaming || (bt_tx_frame_start == 0 && !bt_congested))) {
+        // Once part of a frame has gone out, the rest of
+        // it must follow, so it is written even if the
+        // link becomes congested in the meantime.
+        bt_tx_frame_start = bt_tx_len;
+        bt_tx_streaming = true;
+        bt_tx_send(true);
+      }
+      if (bt_tx_len == BT_TX_BUF_SIZE) {
+        bt_tx_len = bt_tx_frame_start;
+        bt_tx_dropping = true;
+        return;
+      }
+      bt_tx_buf[bt_tx_len++] = byte;
+    }
+
     void bt_confirm_pairing(uint32_t numVal) {
       bt_ssp_pin = numVal;
-      kiss_indicate_btpin();
+      bt_indicate_pin();
       if (bt_allow_pairing) {
         SerialBT.confirmReply(true);
       } else {
@@ -115,7 +188,11 @@ char bt_devname[11];
        
       if(event == ESP_SPP_CLOSE_EVT ){
         bt_state = BT_STATE_ON;
+        bt_congested = false;
       }
+
+      if (event == ESP_SPP_CONG_EVT)  { bt_congested = param->cong.cong; }
+      if (event == ESP_SPP_WRITE_EVT) { bt_congested = param->write.cong; }
     }
 
     bool bt_setup_hw() {
@@ -167,6 +244,7 @@ char bt_devname[11];
       if (bt_allow_pairing && millis()-bt_pairing_started >= BT_PAIRING_TIMEOUT) {
         bt_disable_pairing();
       }
+      if (bt_tx_frame_start > 0 && !bt_congested) { bt_tx_send(); }
     }
 
   #elif HAS_BLE == true
@@ -243,7 +321,7 @@ char bt_devname[11];
       if (bt_allow_pairing) {
         bt_ssp_pin = passkey;
         bt_pairing_started = millis();
-        kiss_indicate_btpin();
+        bt_indicate_pin();
       } else {
         // Serial.println("Pairing not allowed, re-init");
         SerialBT.disconnect();
@@ -393,6 +471,42 @@ char bt_devname[11];
 
   uint8_t eeprom_read(uint32_t mapped_addr);
 
+  // The throughput profile trades power for link speed,
+  // with the largest MTU the SoftDevice supports, long
+  // connection events, deep notify queues and the
+  // shortest connection interval.
+  #define BT_PROFILE_DEFAULT    0x00
+  #define BT_PROFILE_THROUGHPUT 0x01
+  #define BLE_TP_MTU            BLE_GATT_ATT_MTU_MAX
+  #define BLE_TP_EVENT_LEN      24 // 30 ms, in 1.25 ms units
+  #define BLE_TP_QUEUE_LEN      16
+  #define BLE_TP_CONN_INTERVAL  6  // 7.5 ms
+  uint8_t bt_profile = BT_PROFILE_DEFAULT;
+  uint16_t bt_conn_handle = BLE_CONN_HANDLE_INVALID;
+
+  // Incoming BLE data wakes the main loop right away,
+  // rather than on its next idle tick.
+  void bt_rx_callback(uint16_t conn_handle) { loop_wake(); }
+
+  // Outgoing KISS frames are collected here and handed
+  // to BLEUart in one write, which goes out as a burst
+  // of MTU sized notifies.
+  #define BT_TX_BUF_SIZE 1024
+  uint8_t bt_tx_buf[BT_TX_BUF_SIZE];
+  uint16_t bt_tx_len = 0;
+
+  #define BT_STATS_INTERVAL_MS 1000
+  #define BLE_RTT_PROBE        0x01
+  #define BLE_RTT_ECHO         0x02
+  uint32_t bt_tx_bytes = 0;
+  uint32_t bt_rx_bytes = 0;
+  uint32_t bt_tx_rate = 0;
+  uint32_t bt_rx_rate = 0;
+  uint32_t bt_stats_last = 0;
+  uint32_t bt_rtt_probe_sent = 0;
+  bool bt_rtt_probing = false;
+  uint16_t bt_rtt_ms = 0;
+
   void bt_stop() {
     // Serial.println("BT Stop");
     if (bt_state != BT_STATE_OFF) {
@@ -401,7 +515,18 @@ char bt_devname[11];
     }
   }
 
-  void bt_flush() { if (bt_state == BT_STATE_CONNECTED) { SerialBT.flushTXD(); } }
+  void bt_flush() {
+    if (bt_state == BT_STATE_CONNECTED && bt_tx_len > 0) {
+      SerialBT.write(bt_tx_buf, bt_tx_len);
+      bt_tx_bytes += bt_tx_len;
+    }
+    bt_tx_len = 0;
+  }
+
+  void bt_write(uint8_t byte) {
+    if (bt_tx_len == BT_TX_BUF_SIZE) { bt_flush(); }
+    bt_tx_buf[bt_tx_len++] = byte;
+  }
 
   void bt_disable_pairing() {
     // Serial.println("BT Disable pairing");
@@ -451,6 +576,35 @@ char bt_devname[11];
     }
   }
 
+  // The CryptoCell is shared with LESC pairing, which
+  // only runs on links that are not yet secured. A
+  // background user of nRFCrypto waits until no such
+  // link exists, and pauses advertising meanwhile so
+  // that no new one can be opened.
+  bool bt_crypto_adv_paused = false;
+
+  bool bt_crypto_idle() {
+    for (uint16_t h = 0; h < BLE_MAX_CONNECTION; h++) {
+      BLEConnection *conn = Bluefruit.Connection(h);
+      if (conn != NULL && conn->connected() && !conn->secured()) { return false; }
+    }
+    return true;
+  }
+
+  void bt_crypto_release() {
+    if (bt_crypto_adv_paused) { Bluefruit.Advertising.start(0); bt_crypto_adv_paused = false; }
+  }
+
+  void bt_crypto_acquire() {
+    while (true) {
+      while (bt_allow_pairing || !bt_crypto_idle()) { delay(1000); }
+      bt_crypto_adv_paused = Bluefruit.Advertising.isRunning();
+      if (bt_crypto_adv_paused) { Bluefruit.Advertising.stop(); }
+      if (bt_crypto_idle()) { return; }
+      bt_crypto_release();
+    }
+  }
+
   bool bt_passkey_callback(uint16_t conn_handle, uint8_t const passkey[6], bool match_request) {
     // Serial.println("Passkey callback");
     if (bt_allow_pairing) {
@@ -464,10 +618,21 @@ char bt_devname[11];
     bt_state = BT_STATE_CONNECTED;
     cable_state = CABLE_STATE_DISCONNECTED;
 
+    bt_conn_handle = conn_handle;
+    bt_tx_len = 0; bt_tx_bytes = 0; bt_rx_bytes = 0;
+    bt_tx_rate = 0; bt_rx_rate = 0; bt_rtt_probing = false;
+    bt_stats_last = millis();
+
     BLEConnection* conn = Bluefruit.Connection(conn_handle);
     conn->requestPHY(BLE_GAP_PHY_2MBPS);
-    conn->requestMtuExchange(512+3);
-    conn->requestDataLengthUpdate();
+    if (bt_profile == BT_PROFILE_THROUGHPUT) {
+      conn->requestMtuExchange(BLE_TP_MTU);
+      conn->requestDataLengthUpdate();
+      conn->requestConnectionParameter(BLE_TP_CONN_INTERVAL);
+    } else {
+      conn->requestMtuExchange(512+3);
+      conn->requestDataLengthUpdate();
+    }
   }
 
   void bt_disconnect_callback(uint16_t conn_handle, uint8_t reason) {
@@ -501,7 +666,20 @@ char bt_devname[11];
       } else {
         bt_enabled = false;
       }
-      Bluefruit.configPrphBandwidth(BANDWIDTH_MAX);
+      #if HAS_EEPROM
+          bt_profile = EEPROM.read(eeprom_addr(ADDR_CONF_BTP));
+      #else
+          bt_profile = eeprom_read(eeprom_addr(ADDR_CONF_BTP));
+      #endif
+      if (bt_profile != BT_PROFILE_THROUGHPUT) { bt_profile = BT_PROFILE_DEFAULT; }
+
+      // Connection config must be set before Bluefruit is
+      // started, so profile changes apply after a reboot.
+      if (bt_profile == BT_PROFILE_THROUGHPUT) {
+        Bluefruit.configPrphConn(BLE_TP_MTU, BLE_TP_EVENT_LEN, BLE_TP_QUEUE_LEN, BLE_TP_QUEUE_LEN);
+      } else {
+        Bluefruit.configPrphBandwidth(BANDWIDTH_MAX);
+      }
       Bluefruit.autoConnLed(false);
       if (Bluefruit.begin()) {
         uint32_t pin = bt_get_passkey();
@@ -556,7 +734,8 @@ char bt_devname[11];
 
       // Guard to ensure SerialBT service is not duplicated through BT being power cycled
       if (!SerialBT_init) {
-          SerialBT.bufferTXD(true); // enable buffering
+          SerialBT.bufferTXD(false); // frames are buffered by bt_write
+          SerialBT.setRxCallback(bt_rx_callback);
 
           SerialBT.setPermission(SECMODE_ENC_WITH_MITM, SECMODE_ENC_WITH_MITM); // enable encryption for BLE serial
           SerialBT.begin();
@@ -602,7 +781,7 @@ char bt_devname[11];
     bt_allow_pairing = true;
     bt_pairing_started = millis();
     bt_state = BT_STATE_PAIRING;
-    kiss_indicate_btpin();
+    bt_indicate_pin();
   }
 
   void bt_debond_all() { }
@@ -611,5 +790,13 @@ char bt_devname[11];
     if (bt_allow_pairing && millis()-bt_pairing_started >= BT_PAIRING_TIMEOUT) {
       bt_disable_pairing();
     }
+
+    uint32_t elapsed = millis()-bt_stats_last;
+    if (elapsed >= BT_STATS_INTERVAL_MS) {
+      bt_tx_rate = (uint32_t)((uint64_t)bt_tx_bytes*1000/elapsed);
+      bt_rx_rate = (uint32_t)((uint64_t)bt_rx_bytes*1000/elapsed);
+      bt_tx_bytes = 0; bt_rx_bytes = 0;
+      bt_stats_last = millis();
+    }
   }
 #endif
@@ -51,6 +51,25 @@
 	uint8_t wr_state = WR_STATE_OFF;
 	uint8_t wr_channel = WR_CHANNEL_DEFAULT;
 
+	#if (MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52) && (HAS_BLUETOOTH || HAS_BLE == true || HAS_WIFI)
+		#define HAS_HOST_MUX true
+	#else
+		#define HAS_HOST_MUX false
+	#endif
+
+	// Settings that each attached host chooses for
+	// itself are kept per host port
+	#if HAS_HOST_MUX
+		#define MUX_PORT_USB        0x00
+		#define MUX_PORT_BT         0x01
+		#define MUX_PORT_WIFI       0x02
+		#define MUX_PORTS           3
+		#define HOST_PORTS          MUX_PORTS
+	#else
+		#define HOST_PORTS          1
+	#endif
+	#define HOST_PORTS_ALL      ((1 << HOST_PORTS)-1)
+
 	#define M_FRQ_S 27388122
 	#define M_FRQ_R 27388061
 	bool console_active = false;
@@ -74,6 +93,25 @@
 	// MCU independent configuration parameters
 	const long serial_baudrate  = 115200;
 
+	// The host can negotiate a faster UART rate with
+	// CMD_HOST_BAUD. If no valid frame arrives at the
+	// new rate within the timeout, the link falls back
+	// to serial_baudrate.
+	#if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+		#define HAS_HOST_BAUD true
+		#define HOST_BAUD_TIMEOUT_MS 2500
+		#if MCU_VARIANT == MCU_NRF52 || ARDUINO_USB_CDC_ON_BOOT
+			// Native USB links run at USB speed regardless of
+			// the requested rate, so nothing is reconfigured.
+			#define HOST_NATIVE_USB true
+		#else
+			#define HOST_NATIVE_USB false
+		#endif
+		uint32_t host_baudrate = serial_baudrate;
+	#else
+		#define HAS_HOST_BAUD false
+	#endif
+
 	// SX1276 RSSI offset to get dBm value from
 	// packet RSSI register
 	const int  rssi_offset = 157;
@@ -151,12 +189,19 @@
 
 	#define NOISE_FLOOR_SAMPLES 64
 	int     noise_floor     = -292;
+	bool    noise_floor_sampled = false;
+	int     noise_floor_sample  = 0;
+	int     noise_floor_buffer[NOISE_FLOOR_SAMPLES] = {0};
     int     current_rssi    = -292;
 	int		last_rssi		= -292;
 	uint8_t last_rssi_raw   = 0x00;
 	uint8_t last_snr_raw	= 0x80;
 	uint8_t seq				= 0xFF;
 	uint16_t read_len		= 0;
+	long last_freq_error    = 0;
+	uint32_t last_rx_us     = 0;
+	bool last_rx_split      = false;
+	bool rx_ext[HOST_PORTS] = {false};
 	uint16_t host_write_len = 0;
 
 	// Incoming packet buffer
@@ -191,6 +236,44 @@
 		float longterm_airtime = 0.0;
 		#define current_airtime_bin(void) (millis()%AIRTIME_LONGTERM_MS)/AIRTIME_BINLEN_MS
 	#endif
+	// Telemetry subscription, per host port. While the
+	// interval is non-zero, the selected fields are sent
+	// to that host as one TLV frame per interval, and it
+	// no longer gets the unsolicited channel, CSMA and
+	// battery updates, which other hosts still receive.
+	#define TLM_VERSION      0x01
+	#define TLM_T_CONFIG     0x00
+	#define TLM_CHANNEL_UTIL 0x01
+	#define TLM_AIRTIME      0x02
+	#define TLM_NOISE_FLOOR  0x03
+	#define TLM_QUEUE        0x04
+	#define TLM_BATTERY      0x05
+	#define TLM_TEMPERATURE  0x06
+	#define TLM_CSMA         0x07
+	#define TLM_FIELD(t)     (1 << ((t)-1))
+	#define TLM_INTERVAL_MS  100
+	uint16_t telemetry_fields[HOST_PORTS]   = {0x0000};
+	uint16_t telemetry_interval[HOST_PORTS] = {0};
+	uint32_t last_telemetry[HOST_PORTS]     = {0};
+	#define telemetry_subscribed(p) (telemetry_interval[p] != 0)
+
+	// Boot profile. setup() records the time at which
+	// each phase completed, and the host can read the
+	// list back with CMD_BOOT_PROF.
+	#define BOOT_PHASE_EEPROM   0x01
+	#define BOOT_PHASE_SERIAL   0x02
+	#define BOOT_PHASE_MODEM    0x03
+	#define BOOT_PHASE_PMU      0x04
+	#define BOOT_PHASE_BT       0x05
+	#define BOOT_PHASE_RADIO    0x06
+	#define BOOT_PHASE_DISPLAY  0x07
+	#define BOOT_PHASE_WIFI     0x08
+	#define BOOT_PHASE_DONE     0x09
+	#define BOOT_PHASES_MAX     16
+	uint8_t boot_phase_ids[BOOT_PHASES_MAX];
+	uint32_t boot_phase_ms[BOOT_PHASES_MAX];
+	uint8_t boot_phases = 0;
+
 	float st_airtime_limit = 0.0;
 	float lt_airtime_limit = 0.0;
 	bool airtime_lock = false;
@@ -229,7 +312,6 @@
     bool device_init_done = false;
     bool eeprom_ok = false;
     bool firmware_update_mode = false;
-    bool serial_in_frame = false;
 
 	// Boot flags
 	#define START_FROM_BOOTLOADER 0x01
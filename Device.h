@@ -20,13 +20,11 @@
 #include "esp_ota_ops.h"
 #include "esp_flash_partitions.h"
 #include "esp_partition.h"
+#include "nvs.h"
 
 #elif MCU_VARIANT == MCU_NRF52
 #include "Adafruit_nRFCrypto.h"
 
-// size of chunk to retrieve from flash sector
-#define CHUNK_SIZE 128
-
 #define END_SECTION_SIZE 256
 
 #if defined(NRF52840_XXAA)
@@ -38,6 +36,9 @@
 #define USER_DATA_START 0xED000
 
 #define IMG_SIZE_START 0xFF008
+// CRC16 of the application, written by the bootloader
+// along with the size in its settings page
+#define IMG_CRC_START 0xFF002
 #endif
 
 #endif
@@ -47,9 +48,8 @@ void eeprom_update(int mapped_addr, uint8_t byte);
 uint8_t eeprom_read(uint32_t addr);
 void hard_reset(void);
 
-#if !HAS_EEPROM && MCU_VARIANT == MCU_NRF52
-  void eeprom_flush();
-#endif
+void eeprom_txn_begin();
+void eeprom_txn_commit();
 
 const uint8_t dev_keys [] PROGMEM = {
    0x0f, 0x15, 0x86, 0x74, 0xa0, 0x7d, 0xf2, 0xde, 0x32, 0x11, 0x29, 0xc1, 0x0d, 0xda, 0xcc, 0xc3,
@@ -106,9 +106,11 @@ void device_validate_signature() {
 void device_save_signature() {
   device_validate_signature();
   if (dev_signature_validated) {
+    eeprom_txn_begin();
     for (uint8_t i = 0; i < DEV_SIG_LEN; i++) {
       eeprom_update(dev_sig_addr(i), dev_sig[i]);
     }
+    eeprom_txn_commit();
   }
 }
 
@@ -133,12 +135,11 @@ void device_load_firmware_hash() {
 }
 
 void device_save_firmware_hash() {
+  eeprom_txn_begin();
   for (uint8_t i = 0; i < DEV_HASH_LEN; i++) {
     eeprom_update(dev_fwhash_addr(i), dev_firmware_hash_target[i]);
   }
-  #if !HAS_EEPROM && MCU_VARIANT == MCU_NRF52
-    eeprom_flush();
-  #endif
+  eeprom_txn_commit();
   if (!fw_signature_validated) hard_reset();
 }
 
@@ -150,35 +151,198 @@ uint32_t retrieve_application_size() {
     return fw_len;
 }
 
-void calculate_region_hash(unsigned long long start, unsigned long long end, uint8_t* return_hash) {
-    // this function calculates the hash digest of a region of memory,
-    // currently it is only designed to work for the application region
-    uint8_t chunk[CHUNK_SIZE] = {0};
+// The CryptoCell can only read its input from RAM,
+// so flash is staged through one large block instead
+// of being fed to the hash directly. The block is only
+// allocated while hashing, with a small stack buffer
+// as fallback if the heap cannot spare it.
+#define HASH_BLOCK_SIZE 4096
+#define HASH_CHUNK_SIZE 64
 
-    // to store potential last chunk of program
-    uint8_t chunk_next[CHUNK_SIZE] = {0};
-    nRFCrypto_Hash hash;
+void calculate_region_hash(uint32_t start, uint32_t end, uint8_t* return_hash) {
+    uint8_t chunk[HASH_CHUNK_SIZE] __attribute__((aligned(4)));
+    uint32_t block_size = HASH_BLOCK_SIZE;
+    uint8_t *block = (uint8_t *)malloc(HASH_BLOCK_SIZE);
+    if (block == NULL) { block = chunk; block_size = HASH_CHUNK_SIZE; }
 
+    nRFCrypto_Hash hash;
     hash.begin(CRYS_HASH_SHA256_mode);
+    while (start < end) {
+        uint32_t size = end - start;
+        if (size > block_size) size = block_size;
+        memcpy(block, (const void*)start, size);
+        hash.update(block, size);
+        start += size;
+    }
+    hash.end(return_hash);
+    if (block != chunk) free(block);
+}
 
-    uint8_t size;
+// The application hash is cached in a file, keyed by
+// the image size and the CRC the bootloader recorded
+// for it, so a new image is always hashed again.
+#define FW_HASH_CACHE_VERSION 0x01
+#define FW_HASH_CACHE_FILE "fwhash"
+typedef struct {
+  uint8_t version;
+  uint32_t size;
+  uint16_t crc;
+  uint8_t hash[DEV_HASH_LEN];
+} fw_hash_cache_t;
+
+void fw_hash_cache_key(fw_hash_cache_t *entry) {
+  memset(entry, 0x00, sizeof(fw_hash_cache_t));
+  entry->version = FW_HASH_CACHE_VERSION;
+  entry->size = retrieve_application_size();
+  memcpy(&entry->crc, (const void*)IMG_CRC_START, 2);
+}
 
-    while (start < end ) {
-        const void* src = (const void*)start;
-        if (start + CHUNK_SIZE >= end) {
-            size = end - start;
-        }
-        else {
-            size = CHUNK_SIZE;
-        }
+bool fw_hash_cache_load(uint8_t *hash) {
+  fw_hash_cache_t key; fw_hash_cache_t entry;
+  fw_hash_cache_key(&key);
+  File cache(InternalFS); bool found = false;
+  if (cache.open(FW_HASH_CACHE_FILE, FILE_O_READ)) {
+    if (cache.read(&entry, sizeof(fw_hash_cache_t)) == sizeof(fw_hash_cache_t) && memcmp(&key, &entry, offsetof(fw_hash_cache_t, hash)) == 0) {
+      memcpy(hash, entry.hash, DEV_HASH_LEN);
+      found = true;
+    }
+    cache.close();
+  }
+  return found;
+}
 
-        memcpy(chunk, src, CHUNK_SIZE);
+void fw_hash_cache_save(const uint8_t *hash) {
+  fw_hash_cache_t entry;
+  fw_hash_cache_key(&entry);
+  memcpy(entry.hash, hash, DEV_HASH_LEN);
+  InternalFS.remove(FW_HASH_CACHE_FILE);
+  File cache(InternalFS);
+  if (cache.open(FW_HASH_CACHE_FILE, FILE_O_WRITE)) {
+    cache.write((const uint8_t*)&entry, sizeof(fw_hash_cache_t));
+    cache.close();
+  }
+}
+#endif
 
-        hash.update(chunk, size);
+#if MCU_VARIANT == MCU_ESP32
+// Hashing the whole running app partition takes a
+// noticeable part of boot, so its hash is cached in
+// NVS. The cache is keyed by the partition location
+// and the ELF digest from the image's app descriptor,
+// so any newly flashed image is hashed again.
+#define FW_HASH_CACHE_VERSION 0x01
+#define FW_HASH_CACHE_NS  "rnode"
+#define FW_HASH_CACHE_KEY "fwhash"
+typedef struct {
+  uint8_t version;
+  uint32_t address;
+  uint32_t size;
+  uint8_t image_digest[32];
+  uint8_t hash[DEV_HASH_LEN];
+} fw_hash_cache_t;
+
+void fw_hash_cache_key(const esp_partition_t *running, fw_hash_cache_t *entry) {
+  memset(entry, 0x00, sizeof(fw_hash_cache_t));
+  entry->version = FW_HASH_CACHE_VERSION;
+  entry->address = running->address;
+  entry->size = running->size;
+  esp_app_desc_t desc;
+  if (esp_ota_get_partition_description(running, &desc) == ESP_OK) {
+    memcpy(entry->image_digest, desc.app_elf_sha256, sizeof(entry->image_digest));
+  }
+}
 
-        start += CHUNK_SIZE;
+bool fw_hash_cache_load(const esp_partition_t *running, uint8_t *hash) {
+  fw_hash_cache_t key; fw_hash_cache_t entry;
+  fw_hash_cache_key(running, &key);
+  size_t len = sizeof(fw_hash_cache_t);
+  nvs_handle_t handle; bool found = false;
+  if (nvs_open(FW_HASH_CACHE_NS, NVS_READONLY, &handle) == ESP_OK) {
+    if (nvs_get_blob(handle, FW_HASH_CACHE_KEY, &entry, &len) == ESP_OK && len == sizeof(fw_hash_cache_t)) {
+      if (memcmp(&key, &entry, offsetof(fw_hash_cache_t, hash)) == 0) {
+        memcpy(hash, entry.hash, DEV_HASH_LEN);
+        found = true;
+      }
     }
-    hash.end(return_hash);
+    nvs_close(handle);
+  }
+  return found;
+}
+
+void fw_hash_cache_save(const esp_partition_t *running, const uint8_t *hash) {
+  fw_hash_cache_t entry;
+  fw_hash_cache_key(running, &entry);
+  memcpy(entry.hash, hash, DEV_HASH_LEN);
+  nvs_handle_t handle;
+  if (nvs_open(FW_HASH_CACHE_NS, NVS_READWRITE, &handle) == ESP_OK) {
+    nvs_set_blob(handle, FW_HASH_CACHE_KEY, &entry, sizeof(fw_hash_cache_t));
+    nvs_commit(handle);
+    nvs_close(handle);
+  }
+}
+#endif
+
+void device_check_firmware_hash() {
+  #if VALIDATE_FIRMWARE
+    fw_signature_validated = true;
+    for (uint8_t i = 0; i < DEV_HASH_LEN; i++) {
+      if (dev_firmware_hash_target[i] != dev_firmware_hash[i]) {
+        fw_signature_validated = false;
+        break;
+      }
+    }
+  #endif
+}
+
+#if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+#if MCU_VARIANT == MCU_ESP32
+  #define DEV_REVERIFY_PRIO 1
+#else
+  #define DEV_REVERIFY_PRIO TASK_PRIO_LOW
+#endif
+void host_lock_take();
+void host_lock_give();
+
+// Replaces the firmware hash and redoes validation
+// under the host lock, so host replies never see a
+// half-copied hash or a stale validation result.
+void device_publish_firmware_hash(const uint8_t *hash) {
+  host_lock_take();
+  memcpy(dev_firmware_hash, hash, DEV_HASH_LEN);
+  device_check_firmware_hash();
+  host_lock_give();
+}
+
+// When boot used a cached hash, the image is hashed
+// again at low priority once the device is running.
+// A mismatch replaces the cached hash and validation
+// is redone against the fresh one.
+void device_reverify_task(void *param) {
+  uint8_t hash[DEV_HASH_LEN];
+  #if MCU_VARIANT == MCU_ESP32
+    const esp_partition_t *running = esp_ota_get_running_partition();
+    if (esp_partition_get_sha256(running, hash) == ESP_OK) {
+      if (memcmp(hash, dev_firmware_hash, DEV_HASH_LEN) != 0) {
+        fw_hash_cache_save(running, hash);
+        device_publish_firmware_hash(hash);
+      }
+    }
+  #else
+    #if HAS_BLE
+      bt_crypto_acquire();
+    #endif
+    nRFCrypto.begin();
+    calculate_region_hash(APPLICATION_START, APPLICATION_START+retrieve_application_size(), hash);
+    nRFCrypto.end();
+    #if HAS_BLE
+      bt_crypto_release();
+    #endif
+    if (memcmp(hash, dev_firmware_hash, DEV_HASH_LEN) != 0) {
+      fw_hash_cache_save(hash);
+      device_publish_firmware_hash(hash);
+    }
+  #endif
+  vTaskDelete(NULL);
 }
 #endif
 
@@ -194,19 +358,23 @@ void device_validate_partitions() {
   partition.size      = ESP_PARTITION_TABLE_OFFSET;
   partition.type      = ESP_PARTITION_TYPE_APP;
   esp_partition_get_sha256(&partition, dev_bootloader_hash);
-  esp_partition_get_sha256(esp_ota_get_running_partition(), dev_firmware_hash);
+  const esp_partition_t *running = esp_ota_get_running_partition();
+  if (fw_hash_cache_load(running, dev_firmware_hash)) {
+    xTaskCreate(device_reverify_task, "fw_verify", 4096, NULL, DEV_REVERIFY_PRIO, NULL);
+  } else {
+    esp_partition_get_sha256(running, dev_firmware_hash);
+    fw_hash_cache_save(running, dev_firmware_hash);
+  }
   #elif MCU_VARIANT == MCU_NRF52
   // todo, add bootloader, partition table, or softdevice?
-  calculate_region_hash(APPLICATION_START, APPLICATION_START+retrieve_application_size(), dev_firmware_hash);
-  #endif
-  #if VALIDATE_FIRMWARE
-    for (uint8_t i = 0; i < DEV_HASH_LEN; i++) {
-      if (dev_firmware_hash_target[i] != dev_firmware_hash[i]) {
-        fw_signature_validated = false;
-        break;
-      }
-    }
+  if (fw_hash_cache_load(dev_firmware_hash)) {
+    xTaskCreate(device_reverify_task, "fw_verify", 1024, NULL, DEV_REVERIFY_PRIO, NULL);
+  } else {
+    calculate_region_hash(APPLICATION_START, APPLICATION_START+retrieve_application_size(), dev_firmware_hash);
+    fw_hash_cache_save(dev_firmware_hash);
+  }
   #endif
+  device_check_firmware_hash();
 }
 
 bool device_firmware_ok() {
@@ -16,6 +16,38 @@
 #include "Graphics.h"
 #include <Adafruit_GFX.h>
 
+// Rendering runs in its own task where the display
+// bus is not shared with the modem. The T-Deck panel
+// sits on the modem SPI bus, so it renders inline.
+#if (MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52) && BOARD_MODEL != BOARD_TDECK
+  #define DISP_TASK true
+  #if MCU_VARIANT == MCU_ESP32
+    #define DISP_TASK_STACK 6144
+    #define DISP_TASK_PRIO 1
+    #if CONFIG_FREERTOS_UNICORE
+      #define DISP_TASK_CORE tskNO_AFFINITY
+    #else
+      #define DISP_TASK_CORE 0
+    #endif
+  #else
+    #define DISP_TASK_STACK 1536
+    #define DISP_TASK_PRIO TASK_PRIO_LOW
+  #endif
+  TaskHandle_t disp_task_handle = NULL;
+  volatile bool disp_task_run = false;
+
+  // Held by the display task while it draws the areas,
+  // and by the host side while it writes the external
+  // framebuffer or reads the areas back.
+  SemaphoreHandle_t disp_fb_lock = NULL;
+  void display_fb_lock() { if (disp_fb_lock != NULL) xSemaphoreTake(disp_fb_lock, portMAX_DELAY); }
+  void display_fb_unlock() { if (disp_fb_lock != NULL) xSemaphoreGive(disp_fb_lock); }
+#else
+  #define DISP_TASK false
+  void display_fb_lock() { }
+  void display_fb_unlock() { }
+#endif
+
 #if BOARD_MODEL != BOARD_TECHO
   #if BOARD_MODEL == BOARD_TDECK
     #include <Adafruit_ST7789.h>
@@ -32,7 +64,13 @@
 #else
   void (*display_callback)();
   void display_add_callback(void (*callback)()) { display_callback = callback; }
-  void busyCallback(const void* p) { display_callback(); }
+  void busyCallback(const void* p) {
+    #if DISP_TASK
+      // Never re-enter loop() from the display task
+      if (disp_task_handle != NULL && xTaskGetCurrentTaskHandle() == disp_task_handle) { delay(1); return; }
+    #endif
+    display_callback();
+  }
   #define SSD1306_BLACK GxEPD_BLACK
   #define SSD1306_WHITE GxEPD_WHITE
   #include <GxEPD2_BW.h>
@@ -104,16 +142,29 @@
 
 #define SMALL_FONT &Org_01
 
+// I2C panels set the bus rate once at init, and the
+// driver is given the same rate to use during and
+// after its own transfers. On the T-Beam the OLED
+// shares Wire with the AXP PMU, so it stays at the
+// standard rate the PMU is set up with.
+#if BOARD_MODEL == BOARD_TBEAM
+  #define DISP_I2C_CLOCK 100000
+#else
+  #define DISP_I2C_CLOCK 400000
+#endif
+
 #if BOARD_MODEL == BOARD_TDECK
   Adafruit_ST7789 display = Adafruit_ST7789(DISPLAY_CS, DISPLAY_DC, -1);
   #define SSD1306_WHITE ST77XX_WHITE
   #define SSD1306_BLACK ST77XX_BLACK
+  #define DISP_BLIT_W 320
+  uint16_t disp_blit_line[DISP_BLIT_W];
 #elif BOARD_MODEL == BOARD_HELTEC_T114
   ST7789Spi display(&SPI1, DISPLAY_RST, DISPLAY_DC, DISPLAY_CS);
   #define SSD1306_WHITE ST77XX_WHITE
   #define SSD1306_BLACK ST77XX_BLACK
 #elif BOARD_MODEL == BOARD_TBEAM_S_V1
-  Adafruit_SH1106G display = Adafruit_SH1106G(128, 64, &Wire, -1);
+  Adafruit_SH1106G display = Adafruit_SH1106G(128, 64, &Wire, -1, DISP_I2C_CLOCK, DISP_I2C_CLOCK);
   #define SSD1306_WHITE SH110X_WHITE
   #define SSD1306_BLACK SH110X_BLACK
 #elif BOARD_MODEL == BOARD_TECHO
@@ -121,8 +172,31 @@
   uint32_t last_epd_refresh = 0;
   uint32_t last_epd_full_refresh = 0;
   #define REFRESH_PERIOD 300000
+  // A due full refresh waits for a moment with no
+  // queued or ongoing radio traffic, up to this long
+  #define REFRESH_DEFER_MAX 60000
+  bool epd_full_pending = false;
+  uint32_t epd_full_due = 0;
+  uint8_t tx_queue_height();
+#else
+  Adafruit_SSD1306 display(DISP_W, DISP_H, &Wire, DISP_RST, DISP_I2C_CLOCK, DISP_I2C_CLOCK);
+#endif
+
+// Paged monochrome panels keep a shadow of the frame
+// last sent, so only changed column runs are written.
+#if BOARD_MODEL != BOARD_TDECK && BOARD_MODEL != BOARD_HELTEC_T114 && BOARD_MODEL != BOARD_TECHO
+  #define DISP_SHADOW true
+  #define DISP_PAGES (DISP_H/8)
+  #if defined(I2C_BUFFER_LENGTH)
+    #define DISP_I2C_CHUNK (I2C_BUFFER_LENGTH-1)
+  #else
+    #define DISP_I2C_CHUNK 31
+  #endif
+  uint8_t disp_shadow[DISP_W*DISP_PAGES];
+  bool disp_shadow_valid = false;
+  uint8_t disp_i2c_addr = DISP_ADDR;
 #else
-  Adafruit_SSD1306 display(DISP_W, DISP_H, &Wire, DISP_RST);
+  #define DISP_SHADOW false
 #endif
 
 float disp_target_fps = 7;
@@ -141,7 +215,7 @@ uint32_t last_unblank_event = 0;
 uint32_t display_blanking_timeout = DISPLAY_BLANKING_TIMEOUT;
 uint8_t display_unblank_intensity = display_intensity;
 bool display_blanked = false;
-bool display_tx = false;
+volatile bool display_tx = false;
 bool recondition_display = false;
 int disp_update_interval = 1000/disp_target_fps;
 int epd_update_interval = 1000/disp_target_fps;
@@ -149,6 +223,113 @@ uint32_t last_page_flip = 0;
 int page_interval = 4000;
 bool device_signatures_ok();
 bool device_firmware_ok();
+#if HAS_WIFI
+  extern uint8_t wifi_mode;
+  extern bool wifi_is_connected();
+  extern bool wifi_host_is_connected();
+  extern IPAddress wr_device_ip;
+#endif
+
+// Status values rendered by the display. The main
+// loop publishes them with display_snapshot(), and
+// the display task reads a consistent copy under a
+// sequence counter, so neither side takes a lock.
+typedef struct {
+  int last_rssi;
+  int current_rssi;
+  uint8_t last_snr_raw;
+  int lora_sf;
+  uint32_t lora_bitrate;
+  float airtime;
+  float longterm_airtime;
+  float total_channel_util;
+  float longterm_channel_util;
+  float battery_percent;
+  uint8_t battery_state;
+  bool battery_ready;
+  bool battery_installed;
+  bool battery_indeterminate;
+  bool pmu_ready;
+  uint8_t bt_state;
+  uint32_t bt_ssp_pin;
+  uint8_t cable_state;
+  bool radio_online;
+  bool mw_radio_online;
+  bool hw_ready;
+  bool radio_error;
+  bool ext_fb;
+  bool firmware_ok;
+  bool signatures_ok;
+  uint8_t wifi_mode;
+  bool wifi_connected;
+  bool wifi_host_connected;
+  uint32_t wifi_ip;
+} disp_status_t;
+
+disp_status_t ds;
+
+void display_status_fill(disp_status_t *s) {
+  s->last_rssi = last_rssi;
+  s->current_rssi = current_rssi;
+  s->last_snr_raw = last_snr_raw;
+  s->lora_sf = lora_sf;
+  s->lora_bitrate = lora_bitrate;
+  #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+    s->airtime = airtime;
+    s->longterm_airtime = longterm_airtime;
+    s->total_channel_util = total_channel_util;
+    s->longterm_channel_util = longterm_channel_util;
+  #endif
+  s->battery_percent = battery_percent;
+  s->battery_state = battery_state;
+  s->battery_ready = battery_ready;
+  s->battery_installed = battery_installed;
+  s->battery_indeterminate = battery_indeterminate;
+  s->pmu_ready = pmu_ready;
+  s->bt_state = bt_state;
+  s->bt_ssp_pin = bt_ssp_pin;
+  s->cable_state = cable_state;
+  s->radio_online = radio_online;
+  s->mw_radio_online = mw_radio_online;
+  s->hw_ready = hw_ready;
+  s->radio_error = radio_error;
+  s->ext_fb = disp_ext_fb;
+  s->firmware_ok = device_firmware_ok();
+  s->signatures_ok = device_signatures_ok();
+  #if HAS_WIFI
+    s->wifi_mode = wifi_mode;
+    s->wifi_connected = wifi_is_connected();
+    s->wifi_host_connected = wifi_host_is_connected();
+    s->wifi_ip = (uint32_t)wr_device_ip;
+  #endif
+}
+
+#if DISP_TASK
+  disp_status_t disp_status_shared;
+  volatile uint32_t disp_status_seq = 0;
+
+  void display_snapshot() {
+    disp_status_seq++; __sync_synchronize();
+    display_status_fill(&disp_status_shared);
+    __sync_synchronize(); disp_status_seq++;
+  }
+#endif
+
+void display_status_read() {
+  #if DISP_TASK
+    if (disp_task_handle != NULL && xTaskGetCurrentTaskHandle() == disp_task_handle) {
+      uint32_t seq;
+      do {
+        seq = disp_status_seq; __sync_synchronize();
+        if (seq & 1) { delay(1); continue; }
+        memcpy(&ds, &disp_status_shared, sizeof(disp_status_t));
+        __sync_synchronize();
+      } while (seq & 1 || seq != disp_status_seq);
+      return;
+    }
+  #endif
+  display_status_fill(&ds);
+}
 
 #define WATERFALL_SIZE 46
 int waterfall[WATERFALL_SIZE];
@@ -162,6 +343,44 @@ int p_as_y = 0;
 GFXcanvas1 stat_area(64, 64);
 GFXcanvas1 disp_area(64, 64);
 
+// Each area is only copied to the panel when its
+// canvas differs from what was copied last time.
+// Anything that changes the layout around the areas
+// invalidates them, and the panel is cleared once.
+#define AREA_BYTES (64*64/8)
+uint8_t stat_area_shadow[AREA_BYTES];
+uint8_t disp_area_shadow[AREA_BYTES];
+bool disp_areas_valid = false;
+uint8_t disp_layout = 0xFF;
+
+// Screen region touched since the last panel refresh
+bool disp_dirty = false;
+int16_t disp_dirty_x0, disp_dirty_y0, disp_dirty_x1, disp_dirty_y1;
+
+void display_mark_dirty(int16_t x, int16_t y, int16_t w, int16_t h) {
+  if (!disp_dirty) {
+    disp_dirty_x0 = x; disp_dirty_y0 = y; disp_dirty_x1 = x+w; disp_dirty_y1 = y+h;
+    disp_dirty = true;
+  } else {
+    if (x < disp_dirty_x0) disp_dirty_x0 = x;
+    if (y < disp_dirty_y0) disp_dirty_y0 = y;
+    if (x+w > disp_dirty_x1) disp_dirty_x1 = x+w;
+    if (y+h > disp_dirty_y1) disp_dirty_y1 = y+h;
+  }
+}
+
+void display_invalidate() { disp_areas_valid = false; }
+
+bool display_area_changed(GFXcanvas1 *area, uint8_t *shadow) {
+  if (disp_areas_valid && memcmp(area->getBuffer(), shadow, AREA_BYTES) == 0) { return false; }
+  memcpy(shadow, area->getBuffer(), AREA_BYTES);
+  return true;
+}
+
+uint8_t display_layout() {
+  return disp_mode | ds.ext_fb<<2 | firmware_update_mode<<3 | console_active<<4 | device_init_done<<5 | eeprom_ok<<6;
+}
+
 static const uint8_t one_counts[256] = {
   0,  1,  0,  0,  0,  0,  0,  0,  0,  0,  1,  2,  1,  1,  1,  1,
   1,  1,  1,  1,  0,  1,  0,  0,  0,  0,  0,  0,  0,  0,  0,  1,
@@ -261,8 +480,10 @@ uint8_t display_contrast = 0x00;
   }
 #else
   void set_contrast(Adafruit_SSD1306 *display, uint8_t contrast) {
+    wire_lock_take();
     display->ssd1306_command(SSD1306_SETCONTRAST);
     display->ssd1306_command(contrast);
+    wire_lock_give();
   }
 #endif
 
@@ -341,6 +562,9 @@ bool display_init() {
     #else
       uint8_t display_address = DISP_ADDR;
     #endif
+    #if DISP_SHADOW
+      disp_i2c_addr = display_address;
+    #endif
 
     #if HAS_EEPROM
       if (EEPROM.read(eeprom_addr(ADDR_CONF_BSET)) == CONF_OK_BYTE) {
@@ -372,6 +596,7 @@ bool display_init() {
     display.setSPISpeed(80e6);
     #elif BOARD_MODEL == BOARD_HELTEC_T114
     display.init();
+    display.useDMA(PIN_T114_TFT_SCK);
     // set white as default pixel colour for Heltec T114
     display.setRGB(COLOR565(0xFF, 0xFF, 0xFF));
     if (false) {
@@ -382,6 +607,9 @@ bool display_init() {
     #endif
       return false;
     } else {
+      #if DISP_SHADOW
+        Wire.setClock(DISP_I2C_CLOCK);
+      #endif
       set_contrast(&display, display_contrast);
       if (display_rotation != 0xFF) {
         if (display_rotation == 0 || display_rotation == 2) {
@@ -513,16 +741,87 @@ void fillRect(int16_t x, int16_t y, int16_t width, int16_t height, uint16_t colo
   #endif
 }
 
+#if DISPLAY_SCALE != 1
+  // Each output byte of a page buffer holds 8 rows,
+  // which is 8/DISPLAY_SCALE source rows. The table
+  // maps those source bits to the scaled row bits.
+  #define DISP_SCALE_ROWS (8/DISPLAY_SCALE)
+  uint8_t disp_scale_lut[1<<DISP_SCALE_ROWS];
+  bool disp_scale_lut_ready = false;
+
+  void scale_lut_init() {
+    for (uint16_t v = 0; v < (1<<DISP_SCALE_ROWS); v++) {
+      uint8_t out = 0;
+      for (uint8_t i = 0; i < DISP_SCALE_ROWS; i++) {
+        if (v & (1<<i)) out |= ((1<<DISPLAY_SCALE)-1) << (i*DISPLAY_SCALE);
+      }
+      disp_scale_lut[v] = out;
+    }
+    disp_scale_lut_ready = true;
+  }
+#endif
+
 // Draws a bitmap to the display and auto scales it based on the boards configured DISPLAY_SCALE
 void drawBitmap(int16_t startX, int16_t startY, const uint8_t* bitmap, int16_t bitmapWidth, int16_t bitmapHeight, uint16_t foregroundColour, uint16_t backgroundColour) {
   #if DISPLAY_SCALE == 1
     display.drawBitmap(startX, startY, bitmap, bitmapWidth, bitmapHeight, foregroundColour, backgroundColour);
   #else
+    int16_t stride = (bitmapWidth + 7) / 8;
+
+    #if BOARD_MODEL == BOARD_HELTEC_T114
+      // Page aligned bitmaps are expanded straight into
+      // the page buffer, one output byte per scaled column
+      if (8 % DISPLAY_SCALE == 0 && startX >= 0 && startY >= 0 && startY % 8 == 0 && bitmapHeight % DISP_SCALE_ROWS == 0 &&
+          startX + bitmapWidth*DISPLAY_SCALE <= display.width() && startY + bitmapHeight*DISPLAY_SCALE <= display.height()) {
+        if (!disp_scale_lut_ready) scale_lut_init();
+        uint8_t *buf = display.getBuffer();
+        bool fg = foregroundColour == SSD1306_WHITE;
+        bool bg = backgroundColour == SSD1306_WHITE;
+        for (int16_t row = 0; row < bitmapHeight; row += DISP_SCALE_ROWS) {
+          uint8_t *dst = buf + ((startY + row*DISPLAY_SCALE) / 8) * display.width() + startX;
+          const uint8_t *src = bitmap + row * stride;
+          for (int16_t col = 0; col < bitmapWidth; col++) {
+            const uint8_t *s = src + (col >> 3);
+            uint8_t bitmask = 0x80 >> (col & 7);
+            uint8_t v = 0;
+            for (uint8_t i = 0; i < DISP_SCALE_ROWS; i++) { if (s[i*stride] & bitmask) v |= 1<<i; }
+            uint8_t e = disp_scale_lut[v];
+            uint8_t out = fg ? (bg ? 0xFF : e) : (bg ? ~e : 0x00);
+            for (uint8_t i = 0; i < DISPLAY_SCALE; i++) { *dst++ = out; }
+          }
+        }
+        return;
+      }
+    #elif BOARD_MODEL == BOARD_TDECK
+      // The panel shares the modem SPI bus through the
+      // Arduino SPI driver, so there is no DMA path here.
+      // Each source row is expanded once into an RGB565
+      // line, and the bitmap is streamed into a single
+      // address window inside one bus transaction.
+      if (startX >= 0 && startY >= 0 && bitmapWidth*DISPLAY_SCALE <= DISP_BLIT_W &&
+          startX + bitmapWidth*DISPLAY_SCALE <= display.width() && startY + bitmapHeight*DISPLAY_SCALE <= display.height()) {
+        int16_t w = bitmapWidth*DISPLAY_SCALE;
+        display.startWrite();
+        display.setAddrWindow(startX, startY, w, bitmapHeight*DISPLAY_SCALE);
+        for (int16_t row = 0; row < bitmapHeight; row++) {
+          const uint8_t *src = bitmap + row * stride;
+          uint16_t *dst = disp_blit_line;
+          for (int16_t col = 0; col < bitmapWidth; col++) {
+            uint16_t c = (src[col >> 3] & (0x80 >> (col & 7))) ? foregroundColour : backgroundColour;
+            for (uint8_t i = 0; i < DISPLAY_SCALE; i++) { *dst++ = c; }
+          }
+          for (uint8_t i = 0; i < DISPLAY_SCALE; i++) { display.writePixels(disp_blit_line, w); }
+        }
+        display.endWrite();
+        return;
+      }
+    #endif
+
     for(int16_t row = 0; row < bitmapHeight; row++){
         for(int16_t col = 0; col < bitmapWidth; col++){
 
             // determine index and bitmask
-            int16_t index = row * ((bitmapWidth + 7) / 8) + (col / 8);
+            int16_t index = row * stride + (col / 8);
             uint8_t bitmask = 1 << (7 - (col % 8));
 
             // check if the current pixel is set in the bitmap
@@ -539,45 +838,42 @@ void drawBitmap(int16_t startX, int16_t startY, const uint8_t* bitmap, int16_t b
   #endif
 }
 
-extern uint8_t wifi_mode;
-extern bool wifi_is_connected();
-extern bool wifi_host_is_connected();
 void draw_cable_icon(int px, int py) {
   #if HAS_WIFI
-    if (wifi_mode == WR_WIFI_OFF) {
-      if      (cable_state == CABLE_STATE_DISCONNECTED) { stat_area.drawBitmap(px, py, bm_cable+0*32, 16, 16, SSD1306_WHITE, SSD1306_BLACK); }
-      else if (cable_state == CABLE_STATE_CONNECTED)    { stat_area.drawBitmap(px, py, bm_cable+1*32, 16, 16, SSD1306_WHITE, SSD1306_BLACK); }
+    if (ds.wifi_mode == WR_WIFI_OFF) {
+      if      (ds.cable_state == CABLE_STATE_DISCONNECTED) { stat_area.drawBitmap(px, py, bm_cable+0*32, 16, 16, SSD1306_WHITE, SSD1306_BLACK); }
+      else if (ds.cable_state == CABLE_STATE_CONNECTED)    { stat_area.drawBitmap(px, py, bm_cable+1*32, 16, 16, SSD1306_WHITE, SSD1306_BLACK); }
     } else {
-      if (wifi_mode == WR_WIFI_STA) {
-        if (wifi_is_connected()) {
+      if (ds.wifi_mode == WR_WIFI_STA) {
+        if (ds.wifi_connected) {
           stat_area.drawBitmap(px, py, bm_wifi+3*32, 16, 16, SSD1306_WHITE, SSD1306_BLACK);
-          if (!wifi_host_is_connected()) { stat_area.fillRect(px+5, py+12, 6, 3, SSD1306_BLACK); }
+          if (!ds.wifi_host_connected) { stat_area.fillRect(px+5, py+12, 6, 3, SSD1306_BLACK); }
         } else { stat_area.drawBitmap(px, py, bm_wifi+2*32, 16, 16, SSD1306_WHITE, SSD1306_BLACK); }
       
-      } else if (wifi_mode == WR_WIFI_AP) {
-        if (wifi_host_is_connected()) { stat_area.drawBitmap(px, py, bm_wifi+1*32, 16, 16, SSD1306_WHITE, SSD1306_BLACK); }
+      } else if (ds.wifi_mode == WR_WIFI_AP) {
+        if (ds.wifi_host_connected) { stat_area.drawBitmap(px, py, bm_wifi+1*32, 16, 16, SSD1306_WHITE, SSD1306_BLACK); }
         else                          { stat_area.drawBitmap(px, py, bm_wifi+0*32, 16, 16, SSD1306_WHITE, SSD1306_BLACK); }
       
       } else {
-        if      (cable_state == CABLE_STATE_DISCONNECTED) { stat_area.drawBitmap(px, py, bm_cable+0*32, 16, 16, SSD1306_WHITE, SSD1306_BLACK); }
-        else if (cable_state == CABLE_STATE_CONNECTED)    { stat_area.drawBitmap(px, py, bm_cable+1*32, 16, 16, SSD1306_WHITE, SSD1306_BLACK); }
+        if      (ds.cable_state == CABLE_STATE_DISCONNECTED) { stat_area.drawBitmap(px, py, bm_cable+0*32, 16, 16, SSD1306_WHITE, SSD1306_BLACK); }
+        else if (ds.cable_state == CABLE_STATE_CONNECTED)    { stat_area.drawBitmap(px, py, bm_cable+1*32, 16, 16, SSD1306_WHITE, SSD1306_BLACK); }
       }
     }
 
   #else
-  if      (cable_state == CABLE_STATE_DISCONNECTED) { stat_area.drawBitmap(px, py, bm_cable+0*32, 16, 16, SSD1306_WHITE, SSD1306_BLACK); }
-  else if (cable_state == CABLE_STATE_CONNECTED)    { stat_area.drawBitmap(px, py, bm_cable+1*32, 16, 16, SSD1306_WHITE, SSD1306_BLACK); }
+  if      (ds.cable_state == CABLE_STATE_DISCONNECTED) { stat_area.drawBitmap(px, py, bm_cable+0*32, 16, 16, SSD1306_WHITE, SSD1306_BLACK); }
+  else if (ds.cable_state == CABLE_STATE_CONNECTED)    { stat_area.drawBitmap(px, py, bm_cable+1*32, 16, 16, SSD1306_WHITE, SSD1306_BLACK); }
   #endif
 }
 
 void draw_bt_icon(int px, int py) {
-  if (bt_state == BT_STATE_OFF) {
+  if (ds.bt_state == BT_STATE_OFF) {
     stat_area.drawBitmap(px, py, bm_bt+0*32, 16, 16, SSD1306_WHITE, SSD1306_BLACK);
-  } else if (bt_state == BT_STATE_ON) {
+  } else if (ds.bt_state == BT_STATE_ON) {
     stat_area.drawBitmap(px, py, bm_bt+1*32, 16, 16, SSD1306_WHITE, SSD1306_BLACK);
-  } else if (bt_state == BT_STATE_PAIRING) {
+  } else if (ds.bt_state == BT_STATE_PAIRING) {
     stat_area.drawBitmap(px, py, bm_bt+2*32, 16, 16, SSD1306_WHITE, SSD1306_BLACK);
-  } else if (bt_state == BT_STATE_CONNECTED) {
+  } else if (ds.bt_state == BT_STATE_CONNECTED) {
     stat_area.drawBitmap(px, py, bm_bt+3*32, 16, 16, SSD1306_WHITE, SSD1306_BLACK);
   } else {
     stat_area.drawBitmap(px, py, bm_bt+0*32, 16, 16, SSD1306_WHITE, SSD1306_BLACK);
@@ -585,7 +881,7 @@ void draw_bt_icon(int px, int py) {
 }
 
 void draw_lora_icon(int px, int py) {
-  if (radio_online) {
+  if (ds.radio_online) {
     stat_area.drawBitmap(px, py, bm_rf+1*32, 16, 16, SSD1306_WHITE, SSD1306_BLACK);
   } else {
     stat_area.drawBitmap(px, py, bm_rf+0*32, 16, 16, SSD1306_WHITE, SSD1306_BLACK);
@@ -593,7 +889,7 @@ void draw_lora_icon(int px, int py) {
 }
 
 void draw_mw_icon(int px, int py) {
-  if (mw_radio_online) {
+  if (ds.mw_radio_online) {
     stat_area.drawBitmap(px, py, bm_rf+3*32, 16, 16, SSD1306_WHITE, SSD1306_BLACK);
   } else {
     stat_area.drawBitmap(px, py, bm_rf+2*32, 16, 16, SSD1306_WHITE, SSD1306_BLACK);
@@ -602,21 +898,21 @@ void draw_mw_icon(int px, int py) {
 
 uint8_t charge_tick = 0;
 void draw_battery_bars(int px, int py) {
-  if (pmu_ready) {
-    if (battery_ready) {
-      if (battery_installed) {
-        float battery_value = battery_percent;
+  if (ds.pmu_ready) {
+    if (ds.battery_ready) {
+      if (ds.battery_installed) {
+        float battery_value = ds.battery_percent;
 
         // Disable charging state display for now, since
         // boards without dedicated PMU are completely
         // unreliable for determining actual charging state.
         bool disable_charge_status = false;
-        if (battery_indeterminate && battery_state == BATTERY_STATE_CHARGING) {
+        if (ds.battery_indeterminate && ds.battery_state == BATTERY_STATE_CHARGING) {
           disable_charge_status = true;
         }
         
-        if (battery_state == BATTERY_STATE_CHARGING && !disable_charge_status) {
-          float battery_prog = battery_percent;
+        if (ds.battery_state == BATTERY_STATE_CHARGING && !disable_charge_status) {
+          float battery_prog = ds.battery_percent;
           if (battery_prog > 85) { battery_prog = 84; }
           if (charge_tick < battery_prog ) { charge_tick = battery_prog; }
           battery_value = charge_tick;
@@ -624,11 +920,11 @@ void draw_battery_bars(int px, int py) {
           if (charge_tick > 100) charge_tick = 0;
         }
 
-        if (battery_indeterminate && battery_state == BATTERY_STATE_CHARGING && !disable_charge_status) {
+        if (ds.battery_indeterminate && ds.battery_state == BATTERY_STATE_CHARGING && !disable_charge_status) {
           stat_area.fillRect(px-2, py-2, 18, 7, SSD1306_BLACK);
           stat_area.drawBitmap(px-2, py-2, bm_plug, 17, 7, SSD1306_WHITE, SSD1306_BLACK);
         } else {
-          if (battery_state == BATTERY_STATE_CHARGED) {
+          if (ds.battery_state == BATTERY_STATE_CHARGED) {
             stat_area.fillRect(px-2, py-2, 18, 7, SSD1306_BLACK);
             stat_area.drawBitmap(px-2, py-2, bm_plug, 17, 7, SSD1306_WHITE, SSD1306_BLACK);
           } else {
@@ -661,10 +957,10 @@ void draw_battery_bars(int px, int py) {
 #define Q_SNR_MAX 6.0
 void draw_quality_bars(int px, int py) {
   stat_area.fillRect(px, py, 13, 7, SSD1306_BLACK);
-  if (radio_online) {
-    signed char t_snr = (signed int)last_snr_raw;
+  if (ds.radio_online) {
+    signed char t_snr = (signed int)ds.last_snr_raw;
     int snr_int = (int)t_snr;
-    float snr_min = Q_SNR_MIN_BASE-(int)lora_sf*Q_SNR_STEP;
+    float snr_min = Q_SNR_MIN_BASE-(int)ds.lora_sf*Q_SNR_STEP;
     float snr_span = (Q_SNR_MAX-snr_min);
     float snr = ((int)snr_int) * 0.25;
     float quality = ((snr-snr_min)/(snr_span))*100;
@@ -693,8 +989,8 @@ void draw_quality_bars(int px, int py) {
 void draw_signal_bars(int px, int py) {
   stat_area.fillRect(px, py, 13, 7, SSD1306_BLACK);
 
-  if (radio_online) {
-    int rssi_val = last_rssi;
+  if (ds.radio_online) {
+    int rssi_val = ds.last_rssi;
     if (rssi_val < S_RSSI_MIN) rssi_val = S_RSSI_MIN;
     if (rssi_val > S_RSSI_MAX) rssi_val = S_RSSI_MAX;
     int signal = ((rssi_val - S_RSSI_MIN)*(1.0/S_RSSI_SPAN))*100.0;
@@ -723,7 +1019,7 @@ void draw_signal_bars(int px, int py) {
 #define WF_RSSI_SPAN (WF_RSSI_MAX-WF_RSSI_MIN)
 #define WF_PIXEL_WIDTH 10
 void draw_waterfall(int px, int py) {
-  int rssi_val = current_rssi;
+  int rssi_val = ds.current_rssi;
   if (rssi_val < WF_RSSI_MIN) rssi_val = WF_RSSI_MIN;
   if (rssi_val > WF_RSSI_MAX) rssi_val = WF_RSSI_MAX;
   int rssi_normalised = ((rssi_val - WF_RSSI_MIN)*(1.0/WF_RSSI_SPAN))*WF_PIXEL_WIDTH;
@@ -768,7 +1064,7 @@ void draw_stat_area() {
     draw_battery_bars(4, 58);
     draw_quality_bars(28, 56);
     draw_signal_bars(44, 56);
-    if (radio_online) {
+    if (ds.radio_online) {
       draw_waterfall(27, 4);
     }
   }
@@ -778,11 +1074,13 @@ void update_stat_area() {
   if (eeprom_ok && !firmware_update_mode && !console_active) {
 
     draw_stat_area();
+    if (!display_area_changed(&stat_area, stat_area_shadow)) { return; }
+    display_mark_dirty(p_as_x, p_as_y, stat_area.width()*DISPLAY_SCALE+2, stat_area.height()*DISPLAY_SCALE);
     if (disp_mode == DISP_MODE_PORTRAIT) {
       drawBitmap(p_as_x, p_as_y, stat_area.getBuffer(), stat_area.width(), stat_area.height(), SSD1306_WHITE, SSD1306_BLACK);
     } else if (disp_mode == DISP_MODE_LANDSCAPE) {
       drawBitmap(p_as_x+2, p_as_y, stat_area.getBuffer(), stat_area.width(), stat_area.height(), SSD1306_WHITE, SSD1306_BLACK);
-      if (device_init_done && !disp_ext_fb) drawLine(p_as_x, 0, p_as_x, 64, SSD1306_WHITE);
+      if (device_init_done && !ds.ext_fb) drawLine(p_as_x, 0, p_as_x, 64, SSD1306_WHITE);
     }
 
   } else {
@@ -802,9 +1100,6 @@ const uint8_t pages = 3;
 uint8_t disp_page = START_PAGE;
 extern char bt_devname[11];
 extern char bt_dh[16];
-#if HAS_WIFI
-  extern IPAddress wr_device_ip;
-#endif
 void draw_disp_area() {
   if (!device_init_done || firmware_update_mode) {
     uint8_t p_by = 37;
@@ -815,8 +1110,8 @@ void draw_disp_area() {
     if (!device_init_done) disp_area.drawBitmap(0, p_by, bm_boot, disp_area.width(), 27, SSD1306_WHITE, SSD1306_BLACK);
     if (firmware_update_mode) disp_area.drawBitmap(0, p_by, bm_fw_update, disp_area.width(), 27, SSD1306_WHITE, SSD1306_BLACK);
   } else {
-    if (!disp_ext_fb or bt_ssp_pin != 0) {
-      if (radio_online && display_diagnostics) {
+    if (!ds.ext_fb or ds.bt_ssp_pin != 0) {
+      if (ds.radio_online && display_diagnostics) {
         disp_area.fillRect(0,8,disp_area.width(),37, SSD1306_BLACK); disp_area.fillRect(0,37,disp_area.width(),27, SSD1306_WHITE);
         disp_area.setFont(SMALL_FONT); disp_area.setTextWrap(false); disp_area.setTextColor(SSD1306_WHITE); disp_area.setTextSize(1);
 
@@ -825,29 +1120,29 @@ void draw_disp_area() {
         disp_area.setCursor(14, 13);
         disp_area.print("@");
         disp_area.setCursor(21, 13);
-        disp_area.printf("%.1fKbps", (float)lora_bitrate/1000.0);
+        disp_area.printf("%.1fKbps", (float)ds.lora_bitrate/1000.0);
 
         //disp_area.setCursor(31, 23-1);
         disp_area.setCursor(2, 23-1);
         disp_area.print("Airtime:");
         
         disp_area.setCursor(11, 33-1);
-        if (total_channel_util < 0.099) {
+        if (ds.total_channel_util < 0.099) {
           //disp_area.printf("%.1f%%", total_channel_util*100.0);
-          disp_area.printf("%.1f%%", airtime*100.0);
+          disp_area.printf("%.1f%%", ds.airtime*100.0);
         } else {
           //disp_area.printf("%.0f%%", total_channel_util*100.0);
-          disp_area.printf("%.0f%%", airtime*100.0);
+          disp_area.printf("%.0f%%", ds.airtime*100.0);
         }
         disp_area.drawBitmap(2, 26-1, bm_hg_low, 5, 9, SSD1306_WHITE, SSD1306_BLACK);
 
         disp_area.setCursor(32+11, 33-1);
-        if (longterm_channel_util < 0.099) {
+        if (ds.longterm_channel_util < 0.099) {
           //disp_area.printf("%.1f%%", longterm_channel_util*100.0);
-          disp_area.printf("%.1f%%", longterm_airtime*100.0);
+          disp_area.printf("%.1f%%", ds.longterm_airtime*100.0);
         } else {
           //disp_area.printf("%.0f%%", longterm_channel_util*100.0);
-          disp_area.printf("%.0f%%", longterm_airtime*100.0);
+          disp_area.printf("%.0f%%", ds.longterm_airtime*100.0);
         }
         disp_area.drawBitmap(32+2, 26-1, bm_hg_high, 5, 9, SSD1306_WHITE, SSD1306_BLACK);
 
@@ -859,45 +1154,46 @@ void draw_disp_area() {
         disp_area.print("Load:");
         
         disp_area.setCursor(11, 57);
-        if (total_channel_util < 0.099) {
+        if (ds.total_channel_util < 0.099) {
           //disp_area.printf("%.1f%%", airtime*100.0);
-          disp_area.printf("%.1f%%", total_channel_util*100.0);
+          disp_area.printf("%.1f%%", ds.total_channel_util*100.0);
         } else {
           //disp_area.printf("%.0f%%", airtime*100.0);
-          disp_area.printf("%.0f%%", total_channel_util*100.0);
+          disp_area.printf("%.0f%%", ds.total_channel_util*100.0);
         }
         disp_area.drawBitmap(2, 50, bm_hg_low, 5, 9, SSD1306_BLACK, SSD1306_WHITE);
 
         disp_area.setCursor(32+11, 57);
-        if (longterm_channel_util < 0.099) {
+        if (ds.longterm_channel_util < 0.099) {
           //disp_area.printf("%.1f%%", longterm_airtime*100.0);
-          disp_area.printf("%.1f%%", longterm_channel_util*100.0);
+          disp_area.printf("%.1f%%", ds.longterm_channel_util*100.0);
         } else {
           //disp_area.printf("%.0f%%", longterm_airtime*100.0);
-          disp_area.printf("%.0f%%", longterm_channel_util*100.0);
+          disp_area.printf("%.0f%%", ds.longterm_channel_util*100.0);
         }
         disp_area.drawBitmap(32+2, 50, bm_hg_high, 5, 9, SSD1306_BLACK, SSD1306_WHITE);
 
       } else {
-        if (device_signatures_ok()) { disp_area.drawBitmap(0, 0, bm_def_lc, disp_area.width(), 23, SSD1306_WHITE, SSD1306_BLACK); }
+        if (ds.signatures_ok) { disp_area.drawBitmap(0, 0, bm_def_lc, disp_area.width(), 23, SSD1306_WHITE, SSD1306_BLACK); }
         else {                        disp_area.drawBitmap(0, 0, bm_def,    disp_area.width(), 23, SSD1306_WHITE, SSD1306_BLACK); }
 
         bool display_ip = false;
         #if HAS_WIFI
-          if (wifi_is_connected() && disp_page%2 == 1) { display_ip = true; }
+          if (ds.wifi_connected && disp_page%2 == 1) { display_ip = true; }
         #endif
         if (display_ip) {
           #if HAS_WIFI
-            uint8_t ones = 3+one_counts[wr_device_ip[0]]+one_counts[wr_device_ip[1]]+one_counts[wr_device_ip[2]]+one_counts[wr_device_ip[3]];
+            IPAddress ip(ds.wifi_ip);
+            uint8_t ones = 3+one_counts[ip[0]]+one_counts[ip[1]]+one_counts[ip[2]]+one_counts[ip[3]];
             uint8_t chars = 7;
-            for (uint8_t i = 0; i<4; i++) { if (wr_device_ip[i] > 9) { chars++; } if (wr_device_ip[i] > 99) { chars++; } }
+            for (uint8_t i = 0; i<4; i++) { if (ip[i] > 9) { chars++; } if (ip[i] > 99) { chars++; } }
             uint8_t width = chars*6-(ones*4);
             int alignment_offset = disp_area.width()-width;
             int ipxpos = alignment_offset;
             disp_area.setFont(SMALL_FONT); disp_area.setTextWrap(false); disp_area.setTextColor(SSD1306_WHITE); disp_area.setTextSize(1);
             disp_area.fillRect(0, 20, disp_area.width(), 17, SSD1306_BLACK);
             disp_area.setCursor(3, 34-8); disp_area.print("WiFi IP:");
-            disp_area.setCursor(ipxpos, 34); disp_area.print(wr_device_ip);
+            disp_area.setCursor(ipxpos, 34); disp_area.print(ip);
           #endif
         } else {
           disp_area.setFont(SMALL_FONT); disp_area.setTextWrap(false); disp_area.setTextColor(SSD1306_WHITE); disp_area.setTextSize(2);
@@ -910,8 +1206,8 @@ void draw_disp_area() {
         }
       }
 
-      if (!hw_ready || radio_error || !device_firmware_ok()) {
-        if (!device_firmware_ok()) {
+      if (!ds.hw_ready || ds.radio_error || !ds.firmware_ok) {
+        if (!ds.firmware_ok) {
           disp_area.drawBitmap(0, 37, bm_fw_corrupt, disp_area.width(), 27, SSD1306_WHITE, SSD1306_BLACK);
         } else {
           if (!modem_installed) {
@@ -920,9 +1216,9 @@ void draw_disp_area() {
             disp_area.drawBitmap(0, 37, bm_conf_missing, disp_area.width(), 27, SSD1306_WHITE, SSD1306_BLACK);
           }
         }
-      } else if (bt_state == BT_STATE_PAIRING and bt_ssp_pin != 0) {
+      } else if (ds.bt_state == BT_STATE_PAIRING and ds.bt_ssp_pin != 0) {
         char *pin_str = (char*)malloc(DISP_PIN_SIZE+1);
-        sprintf(pin_str, "%06d", bt_ssp_pin);
+        sprintf(pin_str, "%06d", ds.bt_ssp_pin);
 
         disp_area.drawBitmap(0, 37, bm_pairing, disp_area.width(), 27, SSD1306_WHITE, SSD1306_BLACK);
         for (int i = 0; i < DISP_PIN_SIZE; i++) {
@@ -938,13 +1234,13 @@ void draw_disp_area() {
           if (not community_fw and disp_page == 0) disp_page = 1;
         }
 
-        if (radio_online) {
+        if (ds.radio_online) {
           if (!display_diagnostics) {
             disp_area.drawBitmap(0, 37, bm_online, disp_area.width(), 27, SSD1306_WHITE, SSD1306_BLACK);
           }
         } else {
           if (disp_page == 0) {
-            if (true || device_signatures_ok()) {
+            if (true || ds.signatures_ok) {
               disp_area.drawBitmap(0, 37, bm_checks, disp_area.width(), 27, SSD1306_WHITE, SSD1306_BLACK);
             } else {
               disp_area.drawBitmap(0, 37, bm_nfr, disp_area.width(), 27, SSD1306_WHITE, SSD1306_BLACK);
@@ -980,10 +1276,12 @@ void draw_disp_area() {
 
 void update_disp_area() {
   draw_disp_area();
+  if (!display_area_changed(&disp_area, disp_area_shadow)) { return; }
+  display_mark_dirty(p_ad_x, p_ad_y, disp_area.width()*DISPLAY_SCALE, disp_area.height()*DISPLAY_SCALE);
 
   drawBitmap(p_ad_x, p_ad_y, disp_area.getBuffer(), disp_area.width(), disp_area.height(), SSD1306_WHITE, SSD1306_BLACK);
   if (disp_mode == DISP_MODE_LANDSCAPE) {
-    if (device_init_done && !firmware_update_mode && !disp_ext_fb) {
+    if (device_init_done && !firmware_update_mode && !ds.ext_fb) {
       drawLine(0, 0, 0, 63, SSD1306_WHITE);
     }
   }
@@ -1006,6 +1304,58 @@ void display_recondition() {
   #endif
 }
 
+// Sends the changed parts of the frame buffer. On
+// SSD1306 and SH1106 panels each page is compared to
+// the shadow, and only the run of columns between
+// the first and last changed byte is written.
+void display_push() {
+  #if DISP_SHADOW
+    uint8_t *buf = display.getBuffer();
+    wire_lock_take();
+    for (uint8_t page = 0; page < DISP_PAGES; page++) {
+      uint8_t *row = buf + page*DISP_W;
+      uint8_t *shadow_row = disp_shadow + page*DISP_W;
+      int16_t x0 = 0; int16_t x1 = DISP_W-1;
+      if (disp_shadow_valid) {
+        while (x0 < DISP_W && row[x0] == shadow_row[x0]) { x0++; }
+        if (x0 == DISP_W) { continue; }
+        while (row[x1] == shadow_row[x1]) { x1--; }
+      }
+
+      #if BOARD_MODEL == BOARD_TBEAM_S_V1
+        uint8_t col = x0+2; // SH1106 RAM is 132 columns wide
+        display.oled_command(0xB0 + page);
+        display.oled_command(0x10 | (col >> 4));
+        display.oled_command(col & 0x0F);
+      #else
+        display.ssd1306_command(SSD1306_PAGEADDR);
+        display.ssd1306_command(page);
+        display.ssd1306_command(page);
+        display.ssd1306_command(SSD1306_COLUMNADDR);
+        display.ssd1306_command(x0);
+        display.ssd1306_command(x1);
+      #endif
+
+      int16_t x = x0;
+      while (x <= x1) {
+        Wire.beginTransmission(disp_i2c_addr);
+        Wire.write((uint8_t)0x40);
+        int16_t n = x1-x+1; if (n > DISP_I2C_CHUNK) { n = DISP_I2C_CHUNK; }
+        Wire.write(row+x, n);
+        Wire.endTransmission();
+        x += n;
+      }
+      memcpy(shadow_row+x0, row+x0, x1-x0+1);
+    }
+    wire_lock_give();
+    disp_shadow_valid = true;
+  #elif BOARD_MODEL == BOARD_HELTEC_T114
+    // The ST7789 driver diffs against its own back buffer
+    display.display();
+  #endif
+  disp_dirty = false;
+}
+
 bool epd_blanked = false;
 #if BOARD_MODEL == BOARD_TECHO
   void epd_blank(bool full_update = true) {
@@ -1014,6 +1364,36 @@ bool epd_blanked = false;
     display.display(full_update);
   }
 
+  // Refreshes only the region drawn since the last
+  // refresh, and skips the refresh if nothing changed.
+  // Periodic full refreshes are held back until the
+  // radio is idle, so they don't delay transmissions.
+  void epd_update(uint32_t current) {
+    if (!epd_full_pending && current-last_epd_full_refresh >= REFRESH_PERIOD) {
+      epd_full_pending = true;
+      epd_full_due = current;
+    }
+
+    bool radio_idle = tx_queue_height() == 0 && !stat_rx_ongoing && !dcd;
+    if (epd_full_pending && (radio_idle || current-epd_full_due >= REFRESH_DEFER_MAX)) {
+      display.display(false);
+      last_epd_full_refresh = millis();
+      epd_full_pending = false;
+    } else if (disp_dirty) {
+      int16_t x0 = disp_dirty_x0 < 0 ? 0 : disp_dirty_x0;
+      int16_t y0 = disp_dirty_y0 < 0 ? 0 : disp_dirty_y0;
+      int16_t x1 = disp_dirty_x1 > display.width() ? display.width() : disp_dirty_x1;
+      int16_t y1 = disp_dirty_y1 > display.height() ? display.height() : disp_dirty_y1;
+      display.displayWindow(x0, y0, x1-x0, y1-y0);
+    } else {
+      return;
+    }
+
+    disp_dirty = false;
+    last_epd_refresh = millis();
+    epd_blanked = false;
+  }
+
   void epd_black(bool full_update = true) {
     display.setFullWindow();
     display.fillScreen(SSD1306_BLACK);
@@ -1022,7 +1402,9 @@ bool epd_blanked = false;
 #endif
 
 void update_display(bool blank = false) {
+  PROF_SCOPE(PROF_UPDATE_DISPLAY);
   display_updating = true;
+  display_status_read();
   if (blank == true) {
     last_disp_update = millis()-disp_update_interval-1;
   } else {
@@ -1058,14 +1440,15 @@ void update_display(bool blank = false) {
 
       #if BOARD_MODEL == BOARD_HELTEC_T114
         display.clear();
-        display.display();
+        display_push();
       #elif BOARD_MODEL != BOARD_TDECK && BOARD_MODEL != BOARD_TECHO
         display.clearDisplay();
-        display.display();
+        display_push();
       #else
         // TODO: Clear screen
       #endif
 
+      display_invalidate();
       last_disp_update = millis();
     }
 
@@ -1077,35 +1460,40 @@ void update_display(bool blank = false) {
         set_contrast(&display, display_contrast);
       }
 
-      #if BOARD_MODEL == BOARD_HELTEC_T114
-        display.clear();
-      #elif BOARD_MODEL != BOARD_TDECK && BOARD_MODEL != BOARD_TECHO
-        display.clearDisplay();
-      #endif
+      uint8_t layout = display_layout();
+      if (layout != disp_layout) { disp_layout = layout; display_invalidate(); }
+
+      if (!disp_areas_valid) {
+        #if BOARD_MODEL == BOARD_HELTEC_T114
+          display.clear();
+        #elif BOARD_MODEL == BOARD_TDECK
+          display.fillScreen(SSD1306_BLACK);
+        #elif BOARD_MODEL == BOARD_TECHO
+          display.setFullWindow();
+          display.fillScreen(SSD1306_WHITE);
+          display_mark_dirty(0, 0, display.width(), display.height());
+        #else
+          display.clearDisplay();
+        #endif
+      }
 
       if (recondition_display) {
         disp_target_fps = 30;
         disp_update_interval = 1000/disp_target_fps;
         display_recondition();
+        display_invalidate();
       } else {
-        #if BOARD_MODEL == BOARD_TECHO
-          display.setFullWindow();
-          display.fillScreen(SSD1306_WHITE);
-        #endif
-
+        display_fb_lock();
         update_stat_area();
         update_disp_area();
+        display_fb_unlock();
+        disp_areas_valid = true;
       }
       
       #if BOARD_MODEL == BOARD_TECHO
-        if (current-last_epd_refresh >= epd_update_interval) {
-          if (current-last_epd_full_refresh >= REFRESH_PERIOD) { display.display(false); last_epd_full_refresh = millis(); }
-          else { display.display(true); }
-          last_epd_refresh = millis();
-          epd_blanked = false;
-        }
+        if (current-last_epd_refresh >= epd_update_interval) { epd_update(current); }
       #elif BOARD_MODEL != BOARD_TDECK
-        display.display();
+        display_push();
       #endif
 
       last_disp_update = millis();
@@ -1118,6 +1506,38 @@ void display_unblank() {
   last_unblank_event = millis();
 }
 
+#if DISP_TASK
+  void display_task(void *param) {
+    while (disp_task_run) {
+      update_display();
+      int32_t wait = disp_update_interval-(int32_t)(millis()-last_disp_update);
+      if (wait < 1) wait = 1;
+      vTaskDelay(pdMS_TO_TICKS(wait));
+    }
+    disp_task_handle = NULL;
+    vTaskDelete(NULL);
+  }
+
+  void display_task_start() {
+    if (disp_task_handle != NULL) return;
+    if (disp_fb_lock == NULL) disp_fb_lock = xSemaphoreCreateMutex();
+    display_snapshot();
+    disp_task_run = true;
+    #if MCU_VARIANT == MCU_ESP32
+      xTaskCreatePinnedToCore(display_task, "display", DISP_TASK_STACK, NULL, DISP_TASK_PRIO, &disp_task_handle, DISP_TASK_CORE);
+    #else
+      xTaskCreate(display_task, "display", DISP_TASK_STACK, NULL, DISP_TASK_PRIO, &disp_task_handle);
+    #endif
+  }
+
+  // Lets the current frame finish before the caller
+  // takes over the display again.
+  void display_task_stop() {
+    disp_task_run = false;
+    while (disp_task_handle != NULL) { delay(1); }
+  }
+#endif
+
 void ext_fb_enable() {
   disp_ext_fb = true;
 }
@@ -1125,3 +1545,53 @@ void ext_fb_enable() {
 void ext_fb_disable() {
   disp_ext_fb = false;
 }
+
+// Bulk framebuffer writes cover a rectangle of the
+// 8 byte by 64 line framebuffer. The payload is
+// either raw or run-length encoded, and with
+// FB_BULK_XOR it is XORed onto the current content.
+// RLE control bytes below 0x80 are followed by
+// control+1 literal bytes, and 0x80|n repeats the
+// next byte n+1 times. Bytes are decoded as they
+// arrive, so the frame is never buffered.
+uint8_t fb_bulk_op = 0;
+uint8_t fb_bulk_x = 0;
+uint8_t fb_bulk_y = 0;
+uint8_t fb_bulk_w = 0;
+uint16_t fb_bulk_pos = 0;
+uint16_t fb_bulk_len = 0;
+uint8_t fb_bulk_lit = 0;
+uint8_t fb_bulk_run = 0;
+
+bool fb_rect_valid(uint8_t x, uint8_t y, uint8_t w, uint8_t h) {
+  return x < 8 && y < 64 && w > 0 && h > 0 && x+w <= 8 && y+h <= 64;
+}
+
+void fb_bulk_begin(uint8_t op, uint8_t x, uint8_t y, uint8_t w, uint8_t h) {
+  fb_bulk_op = op; fb_bulk_x = x; fb_bulk_y = y; fb_bulk_w = w;
+  fb_bulk_pos = 0; fb_bulk_lit = 0; fb_bulk_run = 0;
+  fb_bulk_len = fb_rect_valid(x, y, w, h) ? w*h : 0;
+}
+
+void fb_bulk_put(uint8_t byte) {
+  if (fb_bulk_pos >= fb_bulk_len) return;
+  uint8_t *p = fb + (fb_bulk_y + fb_bulk_pos/fb_bulk_w)*8 + fb_bulk_x + fb_bulk_pos%fb_bulk_w;
+  if (fb_bulk_op & FB_BULK_XOR) { *p ^= byte; } else { *p = byte; }
+  fb_bulk_pos++;
+}
+
+void fb_bulk_byte(uint8_t byte) {
+  display_fb_lock();
+  if (!(fb_bulk_op & FB_BULK_RLE)) {
+    fb_bulk_put(byte);
+  } else if (fb_bulk_lit) {
+    fb_bulk_put(byte); fb_bulk_lit--;
+  } else if (fb_bulk_run) {
+    while (fb_bulk_run) { fb_bulk_put(byte); fb_bulk_run--; }
+  } else if (byte & 0x80) {
+    fb_bulk_run = (byte & 0x7F)+1;
+  } else {
+    fb_bulk_lit = byte+1;
+  }
+  display_fb_unlock();
+}
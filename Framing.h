@@ -23,6 +23,7 @@
 
   #define CMD_UNKNOWN     0xFE
   #define CMD_DATA        0x00
+  #define CMD_DATA_EXT    0x11
   #define CMD_FREQUENCY   0x01
   #define CMD_BANDWIDTH   0x02
   #define CMD_TXPOWER     0x03
@@ -47,6 +48,10 @@
   #define CMD_STAT_BAT    0x27
   #define CMD_STAT_CSMA   0x28
   #define CMD_STAT_TEMP   0x29
+  #define CMD_STAT_BLE    0x2A
+  #define CMD_TELEMETRY   0x2B
+  #define CMD_BOOT_PROF   0x2C
+  #define CMD_PROF_STATS  0x2D
   #define CMD_BLINK       0x30
   #define CMD_RANDOM      0x40
 
@@ -54,6 +59,7 @@
   #define CMD_FB_READ     0x42
   #define CMD_FB_WRITE    0x43
   #define CMD_FB_READL    0x44
+  #define CMD_FB_BULK     0x86
   #define CMD_DISP_READ   0x66
   #define CMD_DISP_INT    0x45
   #define CMD_DISP_ADDR   0x63
@@ -64,6 +70,8 @@
   #define CMD_BT_CTRL     0x46
   #define CMD_BT_UNPAIR   0x70
   #define CMD_BT_PIN      0x62
+  #define CMD_BT_PROFILE  0x71
+  #define CMD_HOST_BAUD   0x72
   #define CMD_DIS_IA      0x69
   #define CMD_WIFI_MODE   0x6A
   #define CMD_WIFI_SSID   0x6B
@@ -102,6 +110,11 @@
   #define RADIO_STATE_OFF 0x00
   #define RADIO_STATE_ON  0x01
 
+  #define FB_BULK_RLE     0x01
+  #define FB_BULK_XOR     0x02
+  #define FB_BULK_DISP    0x40
+  #define FB_BULK_READ    0x80
+
   #define NIBBLE_SEQ      0xF0
   #define NIBBLE_FLAGS    0x0F
   #define FLAG_SPLIT      0x01
@@ -114,6 +127,7 @@
   #define ERROR_QUEUE_FULL    0x04
   #define ERROR_MEMORY_LOW    0x05
   #define ERROR_MODEM_TIMEOUT 0x06
+  #define ERROR_NOT_ALLOWED   0x07
 
   // Serial framing variables
   size_t frame_len;
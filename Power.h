@@ -194,6 +194,10 @@ bool bat_diff_positive = false;
 #define PMU_SCV_RESET_INTERVAL 3
 void kiss_indicate_battery();
 void kiss_indicate_temperature();
+bool host_tx_unsubscribed();
+void host_tx_all();
+void host_lock_take();
+void host_lock_give();
 
 void measure_temperature() {
   #if PLATFORM == PLATFORM_ESP32
@@ -314,6 +318,7 @@ void measure_battery() {
       float charge_current    = 0;
       float ext_voltage       = 0;
       float ext_current       = 0;
+      wire_lock_take();
       if (PMU->getChipModel() == XPOWERS_AXP192) {
         discharge_current       = ((XPowersAXP192*)PMU)->getBattDischargeCurrent();
         charge_current          = ((XPowersAXP192*)PMU)->getBatteryChargeCurrent();
@@ -350,6 +355,7 @@ void measure_battery() {
         battery_percent = 0.0;
         battery_voltage = 0.0;
       }
+      wire_lock_give();
 
       if (battery_percent > 100.0) battery_percent = 100.0;
       if (battery_percent < 0.0) battery_percent = 0.0;
@@ -392,8 +398,13 @@ void measure_battery() {
   if (battery_ready) {
     pmu_rc++;
     if (pmu_rc%PMU_R_INTERVAL == 0) {
-      kiss_indicate_battery();
-      if (pmu_temp_sensor_ready) { kiss_indicate_temperature(); }
+      host_lock_take();
+      if (host_tx_unsubscribed()) {
+        kiss_indicate_battery();
+        if (pmu_temp_sensor_ready) { kiss_indicate_temperature(); }
+        host_tx_all();
+      }
+      host_lock_give();
     }
   }
 }
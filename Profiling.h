@@ -0,0 +1,117 @@
+// Copyright (C) 2024, Mark Qvist
+
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <https://www.gnu.org/licenses/>.
+
+#ifndef PROFILING_H
+  #define PROFILING_H
+
+  // Hot path profiling is compiled in by building with
+  // -DHAS_PROF=1, and is only available on MCUs with a
+  // free running cycle counter. Each point keeps a call
+  // count, total and max cycles, and a log2 histogram.
+  #ifndef HAS_PROF
+    #define HAS_PROF false
+  #endif
+  #if MCU_VARIANT != MCU_ESP32 && MCU_VARIANT != MCU_NRF52
+    #undef HAS_PROF
+    #define HAS_PROF false
+  #endif
+
+  #define PROF_VERSION        0x01
+  #define PROF_RX_CALLBACK    0x00
+  #define PROF_SERIAL_POLL    0x01
+  #define PROF_BUFFER_SERIAL  0x02
+  #define PROF_FLUSH_QUEUE    0x03
+  #define PROF_TRANSMIT       0x04
+  #define PROF_UPDATE_DISPLAY 0x05
+  #define PROF_MODEM_STATUS   0x06
+  #define PROF_UPDATE_AIRTIME 0x07
+  #define PROF_TX_QUEUE_WAIT  0x08
+  #define PROF_RX_LATENCY     0x09
+  #define PROF_POINTS         10
+
+  // Histogram bin n counts samples of 2^(n+SHIFT) up to
+  // 2^(n+SHIFT+1) cycles. The first and last bins also
+  // take everything below and above that range.
+  #define PROF_HIST_SHIFT     6
+  #define PROF_HIST_BINS      20
+
+  #define PROF_RESET          0x01
+
+  #if HAS_PROF
+    typedef struct {
+      uint32_t count;
+      uint64_t total;
+      uint32_t max;
+      uint32_t hist[PROF_HIST_BINS];
+    } prof_point_t;
+
+    prof_point_t prof_points[PROF_POINTS];
+
+    #if MCU_VARIANT == MCU_ESP32
+      #define PROF_ISR IRAM_ATTR
+      inline uint32_t prof_cycles() { return ESP.getCycleCount(); }
+      inline uint16_t prof_cpu_mhz() { return getCpuFrequencyMhz(); }
+    #elif MCU_VARIANT == MCU_NRF52
+      #define PROF_ISR
+      inline uint32_t prof_cycles() { return DWT->CYCCNT; }
+      inline uint16_t prof_cpu_mhz() { return SystemCoreClock/1000000; }
+    #endif
+
+    void prof_reset() {
+      memset(prof_points, 0, sizeof(prof_points));
+    }
+
+    void prof_init() {
+      #if MCU_VARIANT == MCU_NRF52
+        CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+        DWT->CYCCNT = 0;
+        DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+      #endif
+      prof_reset();
+    }
+
+    void PROF_ISR prof_record(uint8_t id, uint32_t cycles) {
+      prof_point_t *p = &prof_points[id];
+      p->count++;
+      p->total += cycles;
+      if (cycles > p->max) { p->max = cycles; }
+
+      uint8_t bin = 0;
+      if (cycles > 0) { bin = 31 - __builtin_clz(cycles); }
+      bin = (bin > PROF_HIST_SHIFT) ? bin - PROF_HIST_SHIFT : 0;
+      if (bin >= PROF_HIST_BINS) { bin = PROF_HIST_BINS-1; }
+      p->hist[bin]++;
+    }
+
+    // Records the cycles spent between construction and
+    // the end of the enclosing scope, so early returns
+    // are counted too.
+    class prof_scope {
+      public:
+        inline prof_scope(uint8_t id) : _id(id), _start(prof_cycles()) {}
+        inline ~prof_scope() { prof_record(_id, prof_cycles()-_start); }
+      private:
+        uint8_t _id;
+        uint32_t _start;
+    };
+
+    #define PROF_SCOPE(id) prof_scope prof_scope_guard(id)
+  #else
+    #define PROF_SCOPE(id)
+    void prof_init() { }
+    void prof_reset() { }
+  #endif
+
+#endif
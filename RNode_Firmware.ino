@@ -20,19 +20,26 @@
 FIFOBuffer serialFIFO;
 uint8_t serialBuffer[CONFIG_UART_BUFFER_SIZE+1];
 
-FIFOBuffer16 packet_starts;
-uint16_t packet_starts_buf[CONFIG_QUEUE_MAX_LENGTH+1];
-
-FIFOBuffer16 packet_lengths;
-uint16_t packet_lengths_buf[CONFIG_QUEUE_MAX_LENGTH+1];
-
+PacketRing tx_ring;
+PacketDesc tx_ring_desc[CONFIG_QUEUE_MAX_LENGTH+1];
 uint8_t packet_queue[CONFIG_QUEUE_SIZE];
+uint32_t tx_queue_wait_us = 0;
+uint32_t rx_host_latency_us = 0;
+
+uint8_t tx_queue_height() { return pkt_ring_height(&tx_ring); }
+uint16_t tx_queued_bytes() { return pkt_ring_used(&tx_ring); }
 
-volatile uint8_t queue_height = 0;
-volatile uint16_t queued_bytes = 0;
-volatile uint16_t queue_cursor = 0;
-volatile uint16_t current_packet_start = 0;
 volatile bool serial_buffering = false;
+
+#if HAS_HOST_MUX
+  // Each run of bytes in the serial FIFO is tagged with
+  // the port it came from, as (port << 12 | length).
+  #define MUX_SEGMENTS      64
+  #define MUX_SEGMENT_LEN   0x0FFF
+  #define MUX_CHUNK_SIZE    512
+  FIFOBuffer16 mux_segments;
+  uint16_t mux_segments_buf[MUX_SEGMENTS+1];
+#endif
 #if HAS_BLUETOOTH || HAS_BLE == true
   bool bt_init_ran = false;
 #endif
@@ -47,9 +54,32 @@ volatile bool serial_buffering = false;
           size_t len;
           int rssi;
           int snr_raw;
+          long freq_error;
+          uint32_t timestamp;
+          bool split;
           uint8_t data[];
   } modem_packet_t;
   static xQueueHandle modem_packet_queue = NULL;
+
+  // Received packets are delivered to the host by their
+  // own task, which blocks on the modem packet queue and
+  // wakes as soon as the modem ISR posts to it. The main
+  // loop runs the MAC and host I/O, and sleeps between
+  // events instead of spinning. Both hold host_lock while
+  // they use the host link or the modem, and the loop
+  // releases it for the work that needs neither.
+  #if PLATFORM == PLATFORM_ESP32
+    #define RX_TASK_STACK 4096
+    #define RX_TASK_PRIO  2
+  #else
+    #define RX_TASK_STACK 1024
+    #define RX_TASK_PRIO  TASK_PRIO_NORMAL
+  #endif
+  #define LOOP_IDLE_TICKS 1
+  TaskHandle_t rx_task_handle = NULL;
+  TaskHandle_t loop_task_handle = NULL;
+  SemaphoreHandle_t host_lock = NULL;
+  uint8_t loop_depth = 0;
 #endif
 
 char sbuf[128];
@@ -92,6 +122,7 @@ void setup() {
 
     if (!eeprom_begin()) { Serial.write("EEPROM initialisation failed.\r\n"); }
   #endif
+  boot_phase(BOOT_PHASE_EEPROM);
 
   // Seed the PRNG for CSMA R-value selection
   #if MCU_VARIANT == MCU_ESP32
@@ -114,6 +145,7 @@ void setup() {
     unsigned long seed_val = analogRead(0);
   #endif
   randomSeed(seed_val);
+  prof_init();
 
   // Initialise serial communication
   memset(serialBuffer, 0, sizeof(serialBuffer));
@@ -138,6 +170,7 @@ void setup() {
   #endif
 
   serial_interrupt_init();
+  boot_phase(BOOT_PHASE_SERIAL);
 
   // Configure input and output pins
   #if HAS_INPUT
@@ -161,15 +194,18 @@ void setup() {
   memset(cmdbuf, 0, sizeof(cmdbuf));
   
   memset(packet_queue, 0, sizeof(packet_queue));
+  pkt_ring_init(&tx_ring, tx_ring_desc, CONFIG_QUEUE_MAX_LENGTH+1, packet_queue, CONFIG_QUEUE_SIZE);
 
-  memset(packet_starts_buf, 0, sizeof(packet_starts_buf));
-  fifo16_init(&packet_starts, packet_starts_buf, CONFIG_QUEUE_MAX_LENGTH);
-  
-  memset(packet_lengths_buf, 0, sizeof(packet_starts_buf));
-  fifo16_init(&packet_lengths, packet_lengths_buf, CONFIG_QUEUE_MAX_LENGTH);
+  #if HAS_HOST_MUX
+    mux_init();
+    fifo16_init(&mux_segments, mux_segments_buf, MUX_SEGMENTS);
+  #endif
 
   #if PLATFORM == PLATFORM_ESP32 || PLATFORM == PLATFORM_NRF52
     modem_packet_queue = xQueueCreate(MODEM_QUEUE_SIZE, sizeof(modem_packet_t*));
+    host_lock = xSemaphoreCreateRecursiveMutex();
+    wire_lock = xSemaphoreCreateMutex();
+    loop_task_handle = xTaskGetCurrentTaskHandle();
   #endif
 
   // Set chip select, reset and interrupt
@@ -232,37 +268,18 @@ void setup() {
     // so assume that to be the case for now.
     modem_installed = true;
   #endif
-
-  #if HAS_DISPLAY
-    #if HAS_EEPROM
-    if (EEPROM.read(eeprom_addr(ADDR_CONF_DSET)) != CONF_OK_BYTE) {
-    #elif MCU_VARIANT == MCU_NRF52
-    if (eeprom_read(eeprom_addr(ADDR_CONF_DSET)) != CONF_OK_BYTE) {
-    #endif
-      eeprom_update(eeprom_addr(ADDR_CONF_DSET), CONF_OK_BYTE);
-      #if BOARD_MODEL == BOARD_TECHO
-        eeprom_update(eeprom_addr(ADDR_CONF_DINT), 0x03);
-      #else
-        eeprom_update(eeprom_addr(ADDR_CONF_DINT), 0xFF);
-      #endif
-    }
-    #if BOARD_MODEL == BOARD_TECHO
-      display_add_callback(work_while_waiting);
-    #endif
-
-    display_unblank();
-    disp_ready = display_init();
-    update_display();
-  #endif
+  boot_phase(BOOT_PHASE_MODEM);
 
   #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
     #if HAS_PMU == true
       pmu_ready = init_pmu();
+      boot_phase(BOOT_PHASE_PMU);
     #endif
 
     #if HAS_BLUETOOTH || HAS_BLE == true
       bt_init();
       bt_init_ran = true;
+      boot_phase(BOOT_PHASE_BT);
     #endif
 
     if (console_active) {
@@ -272,10 +289,6 @@ void setup() {
         kiss_indicate_reset();
       #endif
     } else {
-      #if HAS_WIFI
-        wifi_mode = EEPROM.read(eeprom_addr(ADDR_CONF_WIFI));
-        if (wifi_mode == WR_WIFI_STA || wifi_mode == WR_WIFI_AP) { wifi_remote_init(); }
-      #endif
       kiss_indicate_reset();
     }
   #endif
@@ -298,6 +311,52 @@ void setup() {
 
   // Validate board health, EEPROM and config
   validate_status();
+  boot_phase(BOOT_PHASE_RADIO);
+
+  // The display and WiFi are not needed to get the
+  // radio running from saved config, so they are
+  // brought up only once it has been started.
+  #if HAS_DISPLAY
+    #if HAS_EEPROM
+    if (EEPROM.read(eeprom_addr(ADDR_CONF_DSET)) != CONF_OK_BYTE) {
+    #elif MCU_VARIANT == MCU_NRF52
+    if (eeprom_read(eeprom_addr(ADDR_CONF_DSET)) != CONF_OK_BYTE) {
+    #endif
+      eeprom_txn_begin();
+      eeprom_update(eeprom_addr(ADDR_CONF_DSET), CONF_OK_BYTE);
+      #if BOARD_MODEL == BOARD_TECHO
+        eeprom_update(eeprom_addr(ADDR_CONF_DINT), 0x03);
+      #else
+        eeprom_update(eeprom_addr(ADDR_CONF_DINT), 0xFF);
+      #endif
+      eeprom_txn_commit();
+    }
+    #if BOARD_MODEL == BOARD_TECHO
+      display_add_callback(work_while_waiting);
+    #endif
+
+    display_unblank();
+    disp_ready = display_init();
+    if (disp_ready && !hw_ready) device_init_done = true;
+    update_display();
+    boot_phase(BOOT_PHASE_DISPLAY);
+  #endif
+
+  #if HAS_WIFI
+    if (!console_active) {
+      wifi_mode = EEPROM.read(eeprom_addr(ADDR_CONF_WIFI));
+      if (wifi_mode == WR_WIFI_STA || wifi_mode == WR_WIFI_AP) { wifi_remote_init(); }
+      boot_phase(BOOT_PHASE_WIFI);
+    }
+  #endif
+
+  #if HAS_DISPLAY && DISP_TASK
+    if (disp_ready) display_task_start();
+  #endif
+  #if PLATFORM == PLATFORM_ESP32 || PLATFORM == PLATFORM_NRF52
+    rx_task_start();
+  #endif
+  boot_phase(BOOT_PHASE_DONE);
 
   if (op_mode != MODE_TNC) LoRa->setFrequency(0);
 }
@@ -310,10 +369,25 @@ void lora_receive() {
   }
 }
 
-inline void kiss_write_packet() {
+// When the host has opted in with CMD_DATA_EXT, the
+// packet is preceded by its RX metadata in the same
+// frame: RSSI, SNR, frequency error (int32), RX time
+// in microseconds (uint32) and a flags byte.
+inline void kiss_write_packet(bool ext) {
   serial_write(FEND);
-  serial_write(CMD_DATA);
-  
+  if (!ext) {
+    serial_write(CMD_DATA);
+  } else {
+    serial_write(CMD_DATA_EXT);
+    escaped_serial_write((uint8_t)(last_rssi+rssi_offset));
+    escaped_serial_write(last_snr_raw);
+    escaped_serial_write(last_freq_error>>24); escaped_serial_write(last_freq_error>>16);
+    escaped_serial_write(last_freq_error>>8);  escaped_serial_write(last_freq_error);
+    escaped_serial_write(last_rx_us>>24); escaped_serial_write(last_rx_us>>16);
+    escaped_serial_write(last_rx_us>>8);  escaped_serial_write(last_rx_us);
+    escaped_serial_write(last_rx_split ? FLAG_SPLIT : 0x00);
+  }
+
   for (uint16_t i = 0; i < host_write_len; i++) {
     #if MCU_VARIANT == MCU_NRF52
       portENTER_CRITICAL();
@@ -329,17 +403,25 @@ inline void kiss_write_packet() {
   }
 
   serial_write(FEND);
+}
+
+// Hosts that opted in to CMD_DATA_EXT get the combined
+// frame, all others the separate RSSI, SNR and data
+// frames.
+inline void kiss_write_rx_packet() {
+  uint8_t ext = host_rx_ext_mask();
+  if (host_tx_only(HOST_PORTS_ALL & ~ext)) {
+    kiss_indicate_stat_rssi();
+    kiss_indicate_stat_snr();
+    kiss_write_packet(false);
+  }
+  if (ext != 0x00 && host_tx_only(ext)) { kiss_write_packet(true); }
+  host_tx_all();
   host_write_len = 0;
 
   #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
     packet_ready = false;
   #endif
-
-  #if MCU_VARIANT == MCU_ESP32
-    #if HAS_BLE
-      bt_flush();
-    #endif
-  #endif
 }
 
 inline void getPacketData(uint16_t len) {
@@ -357,6 +439,7 @@ inline void getPacketData(uint16_t len) {
 }
 
 void ISR_VECT receive_callback(int packet_size) {
+  PROF_SCOPE(PROF_RX_CALLBACK);
   #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
     BaseType_t int_mask;
   #endif
@@ -370,6 +453,8 @@ void ISR_VECT receive_callback(int packet_size) {
     uint8_t header   = LoRa->read(); packet_size--;
     uint8_t sequence = packetSequence(header);
     bool    ready    = false;
+    bool    split    = false;
+    uint32_t rx_us   = micros();
 
     if (isSplitPacket(header) && seq == SEQ_UNSET) {
       // This is the first part of a split
@@ -402,6 +487,7 @@ void ISR_VECT receive_callback(int packet_size) {
       getPacketData(packet_size);
       seq = SEQ_UNSET;
       ready = true;
+      split = true;
 
     } else if (isSplitPacket(header) && seq != sequence) {
       // This split packet does not carry the
@@ -449,14 +535,12 @@ void ISR_VECT receive_callback(int packet_size) {
 
     if (ready) {
       #if MCU_VARIANT != MCU_ESP32 && MCU_VARIANT != MCU_NRF52
-        // We first signal the RSSI of the
-        // recieved packet to the host.
-        kiss_indicate_stat_rssi();
-        kiss_indicate_stat_snr();
-
-        // And then write the entire packet
+        // Signal the RSSI of the received packet
+        // to the host and write the entire packet
+        last_freq_error = LoRa->packetFrequencyError();
+        last_rx_us = rx_us; last_rx_split = split;
         host_write_len = read_len;
-        kiss_write_packet(); read_len = 0;
+        kiss_write_rx_packet(); read_len = 0;
       
       #else
         // Allocate packet struct, but abort if there
@@ -468,7 +552,10 @@ void ISR_VECT receive_callback(int packet_size) {
         #if MCU_VARIANT == MCU_ESP32
           modem_packet->snr_raw = LoRa->packetSnrRaw();
           modem_packet->rssi = LoRa->packetRssi(modem_packet->snr_raw);
+          modem_packet->freq_error = LoRa->packetFrequencyError();
         #endif
+        modem_packet->timestamp = rx_us;
+        modem_packet->split = split;
 
         // Send packet to event queue, but free the
         // allocated memory again if the queue is
@@ -488,15 +575,14 @@ void ISR_VECT receive_callback(int packet_size) {
     #if MCU_VARIANT != MCU_ESP32 && MCU_VARIANT != MCU_NRF52
       last_rssi = LoRa->packetRssi();
       last_snr_raw = LoRa->packetSnrRaw();
+      last_freq_error = LoRa->packetFrequencyError();
+      last_rx_us = micros(); last_rx_split = false;
       getPacketData(packet_size);
 
-      // We first signal the RSSI of the
-      // recieved packet to the host.
-      kiss_indicate_stat_rssi();
-      kiss_indicate_stat_snr();
-
-      // And then write the entire packet
-      kiss_write_packet();
+      // Signal the RSSI of the received packet
+      // to the host and write the entire packet
+      host_write_len = read_len;
+      kiss_write_rx_packet();
 
     #else
       getPacketData(packet_size);
@@ -521,6 +607,9 @@ bool startRadio() {
         radio_online = true;
 
         init_channel_stats();
+        #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+          warm_state_restore();
+        #endif
 
         setTXPower();
         setBandwidth();
@@ -569,39 +658,42 @@ void update_radio_lock() {
   }
 }
 
-bool queue_full() { return (queue_height >= CONFIG_QUEUE_MAX_LENGTH || queued_bytes >= CONFIG_QUEUE_SIZE); }
+bool queue_full() { return (pkt_ring_isfull(&tx_ring) || pkt_ring_free(&tx_ring) == 0); }
+
+// Copies the oldest queued packet into the transmit
+// buffer and releases its slot. Returns its length, or
+// 0 if the descriptor did not hold a valid packet.
+uint16_t dequeue_packet(PacketDesc *d) {
+  uint16_t length = d->length;
+  if (length >= MIN_L && length <= MTU) { pkt_ring_read(&tx_ring, d, tbuf); }
+  else                                  { length = 0; }
+  #if PKT_DESC_TIMESTAMP
+    tx_queue_wait_us = micros() - d->enqueued_us;
+  #endif
+  #if HAS_PROF
+    uint64_t wait_cycles = (uint64_t)tx_queue_wait_us*prof_cpu_mhz();
+    prof_record(PROF_TX_QUEUE_WAIT, wait_cycles > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)wait_cycles);
+  #endif
+  pkt_ring_release(&tx_ring);
+  return length;
+}
 
 volatile bool queue_flushing = false;
 void flush_queue(void) {
+  PROF_SCOPE(PROF_FLUSH_QUEUE);
   if (!queue_flushing) {
     queue_flushing = true;
     led_tx_on(); uint16_t processed = 0;
 
-    #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
-    while (!fifo16_isempty(&packet_starts)) {
-    #else
-    while (!fifo16_isempty_locked(&packet_starts)) {
-    #endif
-
-      uint16_t start = fifo16_pop(&packet_starts);
-      uint16_t length = fifo16_pop(&packet_lengths);
-
-      if (length >= MIN_L && length <= MTU) {
-        for (uint16_t i = 0; i < length; i++) {
-          uint16_t pos = (start+i)%CONFIG_QUEUE_SIZE;
-          tbuf[i] = packet_queue[pos];
-        }
-
-        transmit(length); processed++;
-      }
+    PacketDesc *d;
+    while ((d = pkt_ring_peek(&tx_ring)) != NULL) {
+      uint16_t length = dequeue_packet(d);
+      if (length > 0) { transmit(length); processed++; }
     }
 
     lora_receive(); led_tx_off();
   }
 
-  queue_height = 0;
-  queued_bytes = 0;
-
   #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
     update_airtime();
   #endif
@@ -618,24 +710,10 @@ void pop_queue() {
     queue_flushing = true;
     led_tx_on(); uint16_t processed = 0;
 
-    #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
-    if (!fifo16_isempty(&packet_starts)) {
-    #else
-    if (!fifo16_isempty_locked(&packet_starts)) {
-    #endif
-
-      uint16_t start = fifo16_pop(&packet_starts);
-      uint16_t length = fifo16_pop(&packet_lengths);
-      if (length >= MIN_L && length <= MTU) {
-        for (uint16_t i = 0; i < length; i++) {
-          uint16_t pos = (start+i)%CONFIG_QUEUE_SIZE;
-          tbuf[i] = packet_queue[pos];
-        }
-
-        transmit(length); processed++;
-      }
-      queue_height -= processed;
-      queued_bytes -= length;
+    PacketDesc *d = pkt_ring_peek(&tx_ring);
+    if (d != NULL) {
+      uint16_t length = dequeue_packet(d);
+      if (length > 0) { transmit(length); processed++; }
     }
 
     lora_receive(); led_tx_off();
@@ -692,6 +770,7 @@ void add_airtime(uint16_t written) {
 }
 
 void update_airtime() {
+  PROF_SCOPE(PROF_UPDATE_AIRTIME);
   #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
     uint16_t cb = current_airtime_bin();
     uint16_t pb = cb-1; if (cb-1 < 0) { pb = AIRTIME_BINS-1; }
@@ -708,13 +787,15 @@ void update_airtime() {
 
     #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
       update_csma_parameters();
+      warm_state_update();
     #endif
 
-    kiss_indicate_channel_stats();
+    if (host_tx_unsubscribed()) { kiss_indicate_channel_stats(); host_tx_all(); }
   #endif
 }
 
 void transmit(uint16_t size) {
+  PROF_SCOPE(PROF_TRANSMIT);
   if (radio_online) {
     if (!promisc) {
       uint16_t  written = 0;
@@ -763,36 +844,53 @@ void transmit(uint16_t size) {
   } else { kiss_indicate_error(ERROR_TXFAILED); led_indicate_error(5); }
 }
 
+#if HAS_HOST_MUX
+// Enqueues a complete data frame from a host. Frames are
+// staged per port, so hosts on different transports can
+// never interleave their bytes in the packet queue.
+bool queue_packet(const uint8_t *data, uint16_t len) {
+  if (len < MIN_L || pkt_ring_isfull(&tx_ring) || pkt_ring_free(&tx_ring) < len) { return false; }
+  for (uint16_t i = 0; i < len; i++) { pkt_ring_stage(&tx_ring, data[i]); }
+  return pkt_ring_commit(&tx_ring, len > SINGLE_MTU - HEADER_L ? PKT_FLAG_SPLIT : 0x00);
+}
+#endif
+
 void serial_callback(uint8_t sbyte) {
+  #if HAS_HOST_BAUD
+    host_baud_rx(sbyte);
+  #endif
+
   if (IN_FRAME && sbyte == FEND && command == CMD_DATA) {
     IN_FRAME = false;
 
-    if (!fifo16_isfull(&packet_starts) && queued_bytes < CONFIG_QUEUE_SIZE) {
-        uint16_t s = current_packet_start;
-        int16_t e = queue_cursor-1; if (e == -1) e = CONFIG_QUEUE_SIZE-1;
-        uint16_t l;
-
-        if (s != e) { l = (s < e) ? e - s + 1 : CONFIG_QUEUE_SIZE - s + e + 1; }
-        else        { l = 1; }
-
-        if (l >= MIN_L) {
-            queue_height++;
-            fifo16_push(&packet_starts, s);
-            fifo16_push(&packet_lengths, l);
-            current_packet_start = queue_cursor;
-        }
-    }
+    #if HAS_HOST_MUX
+    mux_port_t *port = &mux_ports[mux_rx_port];
+    queue_packet(port->dbuf, port->dlen);
+    port->dlen = 0;
+    #else
+    // Frames that did not fit completely are dropped
+    // rather than sent truncated.
+    uint16_t l = pkt_ring_staged(&tx_ring);
+    if (l >= MIN_L) { pkt_ring_commit(&tx_ring, l > SINGLE_MTU - HEADER_L ? PKT_FLAG_SPLIT : 0x00); }
+    else            { pkt_ring_discard(&tx_ring); }
+    #endif
 
   } else if (sbyte == FEND) {
     IN_FRAME = true;
     command = CMD_UNKNOWN;
     frame_len = 0;
+    #if HAS_HOST_MUX
+      mux_ports[mux_rx_port].dlen = 0;
+    #endif
   } else if (IN_FRAME && frame_len < MTU) {
     // Have a look at the command byte first
     if (frame_len == 0 && command == CMD_UNKNOWN) {
         command = sbyte;
+        #if HAS_HOST_MUX
+          mux_ports[mux_rx_port].seen = true;
+        #endif
     } else if (command == CMD_DATA) {
-        if (bt_state != BT_STATE_CONNECTED) {
+        if (!host_via_bt()) {
           cable_state = CABLE_STATE_CONNECTED;
         }
         if (sbyte == FESC) {
@@ -803,11 +901,12 @@ void serial_callback(uint8_t sbyte) {
                 if (sbyte == TFESC) sbyte = FESC;
                 ESCAPE = false;
             }
-            if (queue_height < CONFIG_QUEUE_MAX_LENGTH && queued_bytes < CONFIG_QUEUE_SIZE) {
-              queued_bytes++;
-              packet_queue[queue_cursor++] = sbyte;
-              if (queue_cursor == CONFIG_QUEUE_SIZE) queue_cursor = 0;
-            }
+            #if HAS_HOST_MUX
+              mux_port_t *port = &mux_ports[mux_rx_port];
+              if (port->dlen < MTU) { port->dbuf[port->dlen++] = sbyte; }
+            #else
+            pkt_ring_stage(&tx_ring, sbyte);
+            #endif
         }
     } else if (command == CMD_FREQUENCY) {
       if (sbyte == FESC) {
@@ -915,9 +1014,17 @@ void serial_callback(uint8_t sbyte) {
         last_rssi     = -292;
         last_rssi_raw = 0x00;
         last_snr_raw  = 0x80;
+        rx_ext[host_port()] = false;
+        telemetry_interval[host_port()] = 0;
+        #if HAS_HOST_MUX
+          mux_ports[mux_rx_port].seen = false;
+        #endif
+        #if HAS_HOST_BAUD
+          if (host_via_usb() && host_baudrate != serial_baudrate) { host_baud_set(serial_baudrate); }
+        #endif
       }
     } else if (command == CMD_RADIO_STATE) {
-      if (bt_state != BT_STATE_CONNECTED) {
+      if (!host_via_bt()) {
         cable_state = CABLE_STATE_CONNECTED;
         display_unblank();
       }
@@ -976,6 +1083,37 @@ void serial_callback(uint8_t sbyte) {
           }
           kiss_indicate_lt_alock();
         }
+    } else if (command == CMD_TELEMETRY) {
+      #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+        if (sbyte == FESC) {
+            ESCAPE = true;
+        } else {
+            if (ESCAPE) {
+                if (sbyte == TFEND) sbyte = FEND;
+                if (sbyte == TFESC) sbyte = FESC;
+                ESCAPE = false;
+            }
+            if (frame_len < CMD_L) cmdbuf[frame_len++] = sbyte;
+        }
+
+        if (frame_len == 4) {
+          uint8_t p = host_port();
+          telemetry_fields[p]   = (uint16_t)cmdbuf[0] << 8 | (uint16_t)cmdbuf[1];
+          telemetry_interval[p] = (uint16_t)cmdbuf[2] << 8 | (uint16_t)cmdbuf[3];
+          if (telemetry_fields[p] == 0x0000) { telemetry_interval[p] = 0; }
+          kiss_indicate_telemetry(p, true);
+          last_telemetry[p] = millis();
+        }
+      #endif
+    } else if (command == CMD_BOOT_PROF) {
+      kiss_indicate_boot_profile();
+    } else if (command == CMD_PROF_STATS) {
+      kiss_indicate_prof_stats();
+      if (sbyte & PROF_RESET) { prof_reset(); }
+    } else if (command == CMD_DATA_EXT) {
+      if      (sbyte == 0x00) { rx_ext[host_port()] = false; }
+      else if (sbyte == 0x01) { rx_ext[host_port()] = true; }
+      kiss_indicate_rx_ext();
     } else if (command == CMD_STAT_RX) {
       kiss_indicate_stat_rx();
     } else if (command == CMD_STAT_TX) {
@@ -991,7 +1129,7 @@ void serial_callback(uint8_t sbyte) {
       kiss_indicate_random(getRandom());
     } else if (command == CMD_DETECT) {
       if (sbyte == DETECT_REQ) {
-        if (bt_state != BT_STATE_CONNECTED) cable_state = CABLE_STATE_CONNECTED;
+        if (!host_via_bt()) cable_state = CABLE_STATE_CONNECTED;
         kiss_indicate_detect();
       }
     } else if (command == CMD_PROMISC) {
@@ -1074,9 +1212,38 @@ void serial_callback(uint8_t sbyte) {
             uint8_t line = cmdbuf[0];
             if (line > 63) line = 63;
             int fb_o = line*8; 
+            display_fb_lock();
             memcpy(fb+fb_o, cmdbuf+1, 8);
+            display_fb_unlock();
           }
         #endif
+    } else if (command == CMD_FB_BULK) {
+      if (sbyte == FESC) {
+            ESCAPE = true;
+        } else {
+            if (ESCAPE) {
+                if (sbyte == TFEND) sbyte = FEND;
+                if (sbyte == TFESC) sbyte = FESC;
+                ESCAPE = false;
+            }
+            if (frame_len < 5) {
+              cmdbuf[frame_len++] = sbyte;
+              if (frame_len == 5) {
+                uint8_t op = cmdbuf[0];
+                if (op & FB_BULK_READ) {
+                  kiss_indicate_fb_bulk(op, cmdbuf[1], cmdbuf[2], cmdbuf[3], cmdbuf[4]);
+                } else {
+                  #if HAS_DISPLAY
+                    fb_bulk_begin(op, cmdbuf[1], cmdbuf[2], cmdbuf[3], cmdbuf[4]);
+                  #endif
+                }
+              }
+            } else if (!(cmdbuf[0] & FB_BULK_READ)) {
+              #if HAS_DISPLAY
+                fb_bulk_byte(sbyte);
+              #endif
+            }
+        }
     } else if (command == CMD_FB_READ) {
       if (sbyte != 0x00) { kiss_indicate_fb(); }
     } else if (command == CMD_DISP_READ) {
@@ -1166,10 +1333,12 @@ void serial_callback(uint8_t sbyte) {
         }
 
         if (sbyte == 0x00) {
+          eeprom_txn_begin();
           for (uint8_t i = 0; i<33; i++) {
             if (i<frame_len && i<32) { eeprom_update(config_addr(ADDR_CONF_SSID+i), cmdbuf[i]); }
             else                     { eeprom_update(config_addr(ADDR_CONF_SSID+i), 0x00); }
           }
+          eeprom_txn_commit();
         }
       #endif
     } else if (command == CMD_WIFI_PSK) {
@@ -1185,10 +1354,12 @@ void serial_callback(uint8_t sbyte) {
         }
 
         if (sbyte == 0x00) {
+          eeprom_txn_begin();
           for (uint8_t i = 0; i<33; i++) {
             if (i<frame_len && i<32) { eeprom_update(config_addr(ADDR_CONF_PSK+i), cmdbuf[i]); }
             else                     { eeprom_update(config_addr(ADDR_CONF_PSK+i), 0x00); }
           }
+          eeprom_txn_commit();
         }
       #endif
     } else if (command == CMD_WIFI_IP) {
@@ -1203,7 +1374,11 @@ void serial_callback(uint8_t sbyte) {
           if (frame_len < CMD_L) cmdbuf[frame_len++] = sbyte;
         }
 
-        if (frame_len == 4) { for (uint8_t i = 0; i<4; i++) { eeprom_update(config_addr(ADDR_CONF_IP+i), cmdbuf[i]); } }
+        if (frame_len == 4) {
+          eeprom_txn_begin();
+          for (uint8_t i = 0; i<4; i++) { eeprom_update(config_addr(ADDR_CONF_IP+i), cmdbuf[i]); }
+          eeprom_txn_commit();
+        }
       #endif
     } else if (command == CMD_WIFI_NM) {
       #if HAS_WIFI
@@ -1217,7 +1392,11 @@ void serial_callback(uint8_t sbyte) {
           if (frame_len < CMD_L) cmdbuf[frame_len++] = sbyte;
         }
 
-        if (frame_len == 4) { for (uint8_t i = 0; i<4; i++) { eeprom_update(config_addr(ADDR_CONF_NM+i), cmdbuf[i]); } }
+        if (frame_len == 4) {
+          eeprom_txn_begin();
+          for (uint8_t i = 0; i<4; i++) { eeprom_update(config_addr(ADDR_CONF_NM+i), cmdbuf[i]); }
+          eeprom_txn_commit();
+        }
       #endif
     } else if (command == CMD_BT_CTRL) {
       #if HAS_BLUETOOTH || HAS_BLE
@@ -1237,6 +1416,44 @@ void serial_callback(uint8_t sbyte) {
           }
         }
       #endif
+    } else if (command == CMD_HOST_BAUD) {
+      #if HAS_HOST_BAUD
+        if (sbyte == FESC) {
+            ESCAPE = true;
+        } else {
+            if (ESCAPE) {
+                if (sbyte == TFEND) sbyte = FEND;
+                if (sbyte == TFESC) sbyte = FESC;
+                ESCAPE = false;
+            }
+            if (frame_len < CMD_L) cmdbuf[frame_len++] = sbyte;
+        }
+
+        if (frame_len == 4) {
+          uint32_t baud = (uint32_t)cmdbuf[0] << 24 | (uint32_t)cmdbuf[1] << 16 | (uint32_t)cmdbuf[2] << 8 | (uint32_t)cmdbuf[3];
+          host_baud_request(baud);
+        }
+      #endif
+    } else if (command == CMD_BT_PROFILE) {
+      #if MCU_VARIANT == MCU_NRF52 && HAS_BLE
+        if      (sbyte == BT_PROFILE_DEFAULT)    { bt_profile_save(BT_PROFILE_DEFAULT); }
+        else if (sbyte == BT_PROFILE_THROUGHPUT) { bt_profile_save(BT_PROFILE_THROUGHPUT); }
+        kiss_indicate_bt_profile();
+      #endif
+    } else if (command == CMD_STAT_BLE) {
+      #if MCU_VARIANT == MCU_NRF52 && HAS_BLE
+        // RTT is measured as a probe sent to the requesting
+        // host, which echoes it back as soon as it arrives.
+        if (sbyte == BLE_RTT_PROBE) {
+          bt_rtt_probing = true;
+          bt_rtt_probe_sent = millis();
+          kiss_indicate_ble_probe();
+        } else if (sbyte == BLE_RTT_ECHO) {
+          if (bt_rtt_probing) { bt_rtt_ms = millis()-bt_rtt_probe_sent; bt_rtt_probing = false; }
+        } else if (sbyte == 0xFF) {
+          kiss_indicate_ble_stats();
+        }
+      #endif
     } else if (command == CMD_BT_UNPAIR) {
       #if HAS_BLE
         if (sbyte == 0x01) { bt_debond_all(); }
@@ -1299,6 +1516,16 @@ void serial_callback(uint8_t sbyte) {
             display_unblank();
         }
       #endif
+    } else if (command == CMD_MUX_CHAIN) {
+      #if HAS_HOST_MUX
+        if      (sbyte == MUX_UNSUBSCRIBE) { mux_ports[mux_rx_port].subscribed = false; }
+        else if (sbyte == MUX_SUBSCRIBE)   { mux_ports[mux_rx_port].subscribed = true; }
+        kiss_indicate_mux_chain();
+      #endif
+    } else if (command == CMD_MUX_DSCVR) {
+      #if HAS_HOST_MUX
+        if (sbyte == MUX_QUERY) { kiss_indicate_mux_ports(); }
+      #endif
     } else if (command == CMD_DIS_IA) {
       if (sbyte == FESC) {
           ESCAPE = true;
@@ -1353,9 +1580,6 @@ bool medium_free() {
   return !dcd;
 }
 
-bool noise_floor_sampled = false;
-int  noise_floor_sample  = 0;
-int  noise_floor_buffer[NOISE_FLOOR_SAMPLES] = {0};
 void update_noise_floor() {
   #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
     if (!dcd) {
@@ -1385,6 +1609,7 @@ void update_noise_floor() {
 #define LED_ID_TRIG 16
 uint8_t led_id_filter = 0;
 void update_modem_status() {
+  PROF_SCOPE(PROF_MODEM_STATUS);
   #if MCU_VARIANT == MCU_ESP32
     portENTER_CRITICAL(&update_lock);
   #elif MCU_VARIANT == MCU_NRF52
@@ -1592,13 +1817,13 @@ void validate_status() {
       cw_band = (uint8_t)(new_cw_band);
       cw_min  = (cw_band-1) * CSMA_CW_PER_BAND_WINDOWS;
       cw_max  = (cw_band) * CSMA_CW_PER_BAND_WINDOWS - 1;
-      kiss_indicate_csma_stats();
+      if (host_tx_unsubscribed()) { kiss_indicate_csma_stats(); host_tx_all(); }
     }
   }
 #endif
 
 void tx_queue_handler() {
-  if (!airtime_lock && queue_height > 0) {
+  if (!airtime_lock && !pkt_ring_isempty(&tx_ring)) {
     if (csma_cw == -1) {
       csma_cw = random(cw_min, cw_max);
       cw_wait_target = csma_cw * csma_slot_ms;
@@ -1630,48 +1855,91 @@ void tx_queue_handler() {
 
 void work_while_waiting() { loop(); }
 
-void loop() {
-  if (radio_online) {
-    #if MCU_VARIANT == MCU_ESP32
-      modem_packet_t *modem_packet = NULL;
-      if(modem_packet_queue && xQueueReceive(modem_packet_queue, &modem_packet, 0) == pdTRUE && modem_packet) {
-        host_write_len = modem_packet->len;
-        last_rssi      = modem_packet->rssi;
-        last_snr_raw   = modem_packet->snr_raw;
-        memcpy(&pbuf, modem_packet->data, modem_packet->len);
-        free(modem_packet);
-        modem_packet = NULL;
-
-        kiss_indicate_stat_rssi();
-        kiss_indicate_stat_snr();
-        kiss_write_packet();
-      }
-
-      airtime_lock = false;
-      if (st_airtime_limit != 0.0 && airtime >= st_airtime_limit) airtime_lock = true;
-      if (lt_airtime_limit != 0.0 && longterm_airtime >= lt_airtime_limit) airtime_lock = true;
-
-    #elif MCU_VARIANT == MCU_NRF52
-      modem_packet_t *modem_packet = NULL;
-      if(modem_packet_queue && xQueueReceive(modem_packet_queue, &modem_packet, 0) == pdTRUE && modem_packet) {
-        memcpy(&pbuf, modem_packet->data, modem_packet->len);
-        host_write_len = modem_packet->len;
-        free(modem_packet);
-        modem_packet = NULL;
-
+#if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+  void rx_task(void *param) {
+    modem_packet_t *modem_packet = NULL;
+    while (true) {
+      if (xQueueReceive(modem_packet_queue, &modem_packet, portMAX_DELAY) != pdTRUE || !modem_packet) { continue; }
+      xSemaphoreTakeRecursive(host_lock, portMAX_DELAY);
+      memcpy(&pbuf, modem_packet->data, modem_packet->len);
+      host_write_len = modem_packet->len;
+      last_rx_us     = modem_packet->timestamp;
+      last_rx_split  = modem_packet->split;
+      #if MCU_VARIANT == MCU_ESP32
+        last_rssi       = modem_packet->rssi;
+        last_snr_raw    = modem_packet->snr_raw;
+        last_freq_error = modem_packet->freq_error;
+      #else
         portENTER_CRITICAL();
         last_rssi = LoRa->packetRssi();
         last_snr_raw = LoRa->packetSnrRaw();
+        last_freq_error = LoRa->packetFrequencyError();
         portEXIT_CRITICAL();
-        kiss_indicate_stat_rssi();
-        kiss_indicate_stat_snr();
-        kiss_write_packet();
-      }
+      #endif
+      free(modem_packet);
+      modem_packet = NULL;
+
+      kiss_write_rx_packet();
+
+      // Time from the modem interrupt until the packet
+      // was written to the host
+      rx_host_latency_us = micros() - last_rx_us;
+      #if HAS_PROF
+        uint64_t latency_cycles = (uint64_t)rx_host_latency_us*prof_cpu_mhz();
+        prof_record(PROF_RX_LATENCY, latency_cycles > 0xFFFFFFFF ? 0xFFFFFFFF : (uint32_t)latency_cycles);
+      #endif
+      xSemaphoreGiveRecursive(host_lock);
+    }
+  }
+
+  void rx_task_start() {
+    if (rx_task_handle != NULL || !modem_packet_queue || !host_lock) { return; }
+    #if MCU_VARIANT == MCU_ESP32
+      xTaskCreatePinnedToCore(rx_task, "rx", RX_TASK_STACK, NULL, RX_TASK_PRIO, &rx_task_handle, xPortGetCoreID());
+    #else
+      xTaskCreate(rx_task, "rx", RX_TASK_STACK, NULL, RX_TASK_PRIO, &rx_task_handle);
+    #endif
+  }
+
+  // True if host input is already waiting, in which case
+  // the loop should run again without sleeping.
+  bool host_pending() {
+    if (!fifo_isempty(&serialFIFO) || Serial.available()) { return true; }
+    #if HAS_BLUETOOTH || HAS_BLE == true
+      if (bt_state == BT_STATE_CONNECTED && SerialBT.available()) { return true; }
+    #endif
+    return false;
+  }
+
+  // Sleeps until the next tick or until loop_wake() is
+  // called. The DCD sampling and CSMA timers all run at
+  // millisecond granularity, so a single tick is the
+  // longest the loop may sleep.
+  void loop_idle() {
+    if (!host_pending()) { ulTaskNotifyTake(pdTRUE, LOOP_IDLE_TICKS); }
+  }
+
+  void loop_wake() {
+    if (loop_task_handle) { xTaskNotifyGive(loop_task_handle); }
+  }
 
+  // Taken around host writes made from the parts of the
+  // loop that run without the lock
+  void host_lock_take() { if (host_lock) { xSemaphoreTakeRecursive(host_lock, portMAX_DELAY); } }
+  void host_lock_give() { if (host_lock) { xSemaphoreGiveRecursive(host_lock); } }
+#endif
+
+void loop() {
+  #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+    host_lock_take();
+    loop_depth++;
+  #endif
+
+  if (radio_online) {
+    #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
       airtime_lock = false;
       if (st_airtime_limit != 0.0 && airtime >= st_airtime_limit) airtime_lock = true;
       if (lt_airtime_limit != 0.0 && longterm_airtime >= lt_airtime_limit) airtime_lock = true;
-
     #endif
 
     tx_queue_handler();
@@ -1696,28 +1964,17 @@ void loop() {
   #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
       buffer_serial();
       if (!fifo_isempty(&serialFIFO)) serial_poll();
+      #if HAS_HOST_BAUD
+        host_baud_check();
+      #endif
+      update_telemetry();
   #else
     if (!fifo_isempty_locked(&serialFIFO)) serial_poll();
   #endif
 
-  #if HAS_DISPLAY
-    if (disp_ready && !display_updating) update_display();
-  #endif
-
-  #if HAS_PMU
-    if (pmu_ready) update_pmu();
-  #endif
-
   #if HAS_BLUETOOTH || HAS_BLE == true
     if (!console_active && bt_ready) update_bt();
-  #endif
-
-  #if HAS_WIFI
-    if (wifi_initialized) update_wifi();
-  #endif
-
-  #if HAS_INPUT
-    input_read();
+    if (bt_pin_pending) { bt_pin_pending = false; kiss_indicate_btpin(); }
   #endif
 
   if (memory_low) {
@@ -1731,10 +1988,44 @@ void loop() {
       kiss_indicate_error(ERROR_MEMORY_LOW); memory_low = false;
     #endif
   }
+
+  #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+    host_lock_give();
+  #endif
+
+  #if HAS_DISPLAY
+    #if DISP_TASK
+      if (disp_ready) display_snapshot();
+    #else
+      if (disp_ready && !display_updating) update_display();
+    #endif
+  #endif
+
+  #if HAS_PMU
+    if (pmu_ready) update_pmu();
+  #endif
+
+  #if HAS_WIFI
+    if (wifi_initialized) update_wifi();
+  #endif
+
+  #if HAS_INPUT
+    input_read();
+  #endif
+
+  #if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+    loop_depth--;
+    // Only the outermost loop may sleep, since nested
+    // runs come from code that is busy waiting.
+    if (loop_depth == 0 && rx_task_handle) { loop_idle(); }
+  #endif
 }
 
 void sleep_now() {
   #if HAS_SLEEP == true
+    #if HAS_DISPLAY && DISP_TASK
+      display_task_stop();
+    #endif
     stopRadio(); // TODO: Check this on all platforms
     #if PLATFORM == PLATFORM_ESP32
       #if BOARD_MODEL == BOARD_T3S3 || BOARD_MODEL == BOARD_XIAO_S3
@@ -1786,6 +2077,9 @@ void button_event(uint8_t event, unsigned long duration) {
     if (display_blanked) {
       display_unblank();
     } else {
+      // Button actions change the host link and the
+      // radio, so they run under the host lock
+      host_lock_take();
       if (duration > 10000) {
         #if HAS_CONSOLE
           #if HAS_BLUETOOTH || HAS_BLE
@@ -1815,14 +2109,29 @@ void button_event(uint8_t event, unsigned long duration) {
         }
         #endif
       }
+      host_lock_give();
     }
   #endif
 }
 
 volatile bool serial_polling = false;
 void serial_poll() {
+  PROF_SCOPE(PROF_SERIAL_POLL);
   serial_polling = true;
 
+  #if HAS_HOST_MUX
+  while (!fifo16_isempty(&mux_segments)) {
+    uint16_t segment = fifo16_pop(&mux_segments);
+    uint16_t len = segment & MUX_SEGMENT_LEN;
+    mux_select_port(segment >> 12);
+    #if HAS_WIFI
+      if ((segment >> 12) == MUX_PORT_WIFI) { wifi_remote_rx_origin(); }
+    #endif
+    mux_replying = true;
+    while (len-- > 0 && !fifo_isempty(&serialFIFO)) { serial_callback(fifo_pop(&serialFIFO)); }
+    mux_replying = false;
+  }
+  #else
   #if MCU_VARIANT != MCU_ESP32 && MCU_VARIANT != MCU_NRF52
   while (!fifo_isempty_locked(&serialFIFO)) {
   #else
@@ -1831,53 +2140,95 @@ void serial_poll() {
     char sbyte = fifo_pop(&serialFIFO);
     serial_callback(sbyte);
   }
+  #endif
 
   serial_polling = false;
 }
 
+#if HAS_HOST_MUX
+// Reads whatever a port has available straight into
+// the free region of the serial FIFO, and tags it with
+// the port it came from.
+void mux_buffer_port(uint8_t port, Stream &stream) {
+  size_t n = stream.available();
+  if (n > MUX_CHUNK_SIZE) { n = MUX_CHUNK_SIZE; }
+  while (n > 0 && !fifo16_isfull(&mux_segments)) {
+    unsigned char *region;
+    size_t span = fifo_free_region(&serialFIFO, &region);
+    if (span == 0) { break; }
+    if (span > n) { span = n; }
+    span = stream.readBytes(region, span);
+    if (span == 0) { break; }
+    fifo_commit(&serialFIFO, span);
+    fifo16_push(&mux_segments, (uint16_t)port << 12 | span);
+    n -= span;
+    #if MCU_VARIANT == MCU_NRF52 && HAS_BLE
+      if (port == MUX_PORT_BT) { bt_rx_bytes += span; }
+    #endif
+  }
+}
+#endif
+
 #if MCU_VARIANT != MCU_ESP32
   #define MAX_CYCLES 20
 #else
   #define MAX_CYCLES 10
 #endif
 void buffer_serial() {
+  PROF_SCOPE(PROF_BUFFER_SERIAL);
   if (!serial_buffering) {
     serial_buffering = true;
 
-    uint8_t c = 0;
-
-    #if HAS_BLUETOOTH || HAS_BLE == true
-    while (
-      c < MAX_CYCLES &&
+    #if HAS_HOST_MUX
       #if HAS_WIFI
-      ( (bt_state != BT_STATE_CONNECTED && Serial.available()) || (bt_state == BT_STATE_CONNECTED && SerialBT.available()) || (wr_state >= WR_STATE_ON && wifi_remote_available()) )
-      #else
-      ( (bt_state != BT_STATE_CONNECTED && Serial.available()) || (bt_state == BT_STATE_CONNECTED && SerialBT.available()) )
+        // WiFi remote clients are drained in bulk, and
+        // their frames are handed to the serial FIFO
+        // whole by buffer_serial_frame, or piece by
+        // piece if larger than a client buffer.
+        if (wr_state >= WR_STATE_ON) { wifi_remote_service(); }
       #endif
-      )
+
+      mux_buffer_port(MUX_PORT_USB, Serial);
+      #if HAS_BLUETOOTH || HAS_BLE == true
+        if (bt_state == BT_STATE_CONNECTED) { mux_buffer_port(MUX_PORT_BT, SerialBT); }
+      #endif
+
     #else
-    while (c < MAX_CYCLES && Serial.available())
-    #endif
-    {
-      c++;
+      uint8_t c = 0;
+      while (c < MAX_CYCLES && Serial.available()) {
+        c++;
 
-      #if MCU_VARIANT != MCU_ESP32 && MCU_VARIANT != MCU_NRF52
-        if (!fifo_isfull_locked(&serialFIFO)) { fifo_push_locked(&serialFIFO, Serial.read()); }
-      #elif HAS_BLUETOOTH || HAS_BLE == true || HAS_WIFI
-        if      (bt_state == BT_STATE_CONNECTED) { if (!fifo_isfull(&serialFIFO)) { fifo_push(&serialFIFO, SerialBT.read()); } }
-        #if HAS_WIFI
-        else if (wifi_host_is_connected())       { if (!fifo_isfull(&serialFIFO)) { fifo_push(&serialFIFO, wifi_remote_read()); } }
+        #if MCU_VARIANT != MCU_ESP32 && MCU_VARIANT != MCU_NRF52
+          if (!fifo_isfull_locked(&serialFIFO)) { fifo_push_locked(&serialFIFO, Serial.read()); }
+        #else
+          if (!fifo_isfull(&serialFIFO)) { fifo_push(&serialFIFO, Serial.read()); }
         #endif
-        else                                     { if (!fifo_isfull(&serialFIFO)) { fifo_push(&serialFIFO, Serial.read()); } }
-      #else
-        if (!fifo_isfull(&serialFIFO)) { fifo_push(&serialFIFO, Serial.read()); }
-      #endif
-    }
+      }
+    #endif
 
     serial_buffering = false;
   }
 }
 
+#if HAS_WIFI
+// Copies a KISS frame, or one piece of a streamed one,
+// into the serial FIFO, but only if all of it fits. Returns false and leaves
+// the FIFO untouched otherwise.
+bool buffer_serial_frame(const uint8_t *frame, size_t len) {
+  if (len > MUX_SEGMENT_LEN || fifo16_isfull(&mux_segments) || fifo_free_space(&serialFIFO) < len) { return false; }
+  fifo16_push(&mux_segments, (uint16_t)MUX_PORT_WIFI << 12 | len);
+  while (len > 0) {
+    unsigned char *region;
+    size_t span = fifo_free_region(&serialFIFO, &region);
+    if (span > len) { span = len; }
+    memcpy(region, frame, span);
+    fifo_commit(&serialFIFO, span);
+    frame += span; len -= span;
+  }
+  return true;
+}
+#endif
+
 void serial_interrupt_init() {
   #if MCU_VARIANT == MCU_1284P
       TCCR3A = 0;
@@ -46,6 +46,7 @@
   #define ADDR_CONF_DIA  0xB9
   #define ADDR_CONF_WIFI 0xBA
   #define ADDR_CONF_WCHN 0xBB
+  #define ADDR_CONF_BTP  0xBC
 
   #define INFO_LOCK_BYTE 0x73
   #define CONF_OK_BYTE   0x73
@@ -14,6 +14,9 @@
 // along with this program.  If not, see <https://www.gnu.org/licenses/>.
 
 #include <WiFi.h>
+#include <WiFiUdp.h>
+#include <lwip/sockets.h>
+#include <errno.h>
 
 #if CONFIG_IDF_TARGET_ESP32
   #include "esp32/rom/rtc.h"
@@ -31,14 +34,81 @@
 #define WR_SOCKET_TIMEOUT 6
 #define WR_READ_TIMEOUT_MS 6500
 #define WR_RECONNECT_INTERVAL_MS 10000
+#define WR_TX_BUF_SIZE 1460
+#define WR_MAX_CLIENTS 4
+#define WR_CLIENT_BUF_SIZE 1024
+#define WR_CLIENT_TX_SIZE 4096
+#define WR_PORT 7633
+#define WR_UDP_TX_SLOTS 4
+#define WR_UDP_RX_BURST 8
+#define WR_RX_ORIGINS 64
+
+// The UDP transport is off unless the firmware is
+// built with -DWR_UDP_ENABLED=1, since any host on
+// the network can register with it.
+#ifndef WR_UDP_ENABLED
+  #define WR_UDP_ENABLED false
+#endif
 
 uint32_t wifi_update_interval_ms = WIFI_UPDATE_INTERVAL_MS;
 uint32_t last_wifi_update = 0;
 uint32_t wr_last_connect_try = 0;
-uint32_t wr_last_read = 0;
 
-WiFiClient connection;
-WiFiServer remote_listener(7633, 1);
+// Each connected host gets its own socket and staging
+// buffer, so that KISS frames from different hosts are
+// only ever handed to the serial FIFO whole. The first
+// host to connect is the primary, and is the only one
+// allowed to change device configuration. Outgoing data
+// waits in a bounded per-client ring until the socket
+// takes it, so one slow client never stalls the others.
+typedef struct {
+  WiFiClient client;
+  bool active;
+  uint32_t connected_at;
+  uint32_t last_read;
+  uint16_t rx_len;
+  uint8_t rx_buf[WR_CLIENT_BUF_SIZE];
+  uint16_t tx_head;
+  uint16_t tx_len;
+  uint8_t tx_buf[WR_CLIENT_TX_SIZE];
+} wr_client_t;
+
+wr_client_t wr_clients[WR_MAX_CLIENTS];
+int8_t wr_primary = -1;
+bool wr_client_dropped = false;
+
+// Frames larger than the staging buffer are streamed
+// to the serial FIFO in pieces. While that happens, the
+// WiFi port belongs to the streaming client, and other
+// clients wait until its closing FEND has been handed
+// over, so their frames cannot land inside it.
+int8_t wr_stream_client = -1;
+bool wr_stream_allowed = false;
+uint8_t wr_rr_next = 0;
+
+WiFiServer remote_listener(WR_PORT, WR_MAX_CLIENTS);
+
+// A single host can alternatively attach over UDP on
+// the same port, with each datagram carrying exactly
+// one KISS frame. The host registers by sending a
+// detect request, and must keep sending frames at
+// least every WR_READ_TIMEOUT_MS to stay registered.
+// Outgoing frames that cannot be handed to lwIP are
+// held in a small ring, where the oldest frame is
+// dropped when a new one arrives and the ring is full.
+bool wr_udp_active = false;
+#if WR_UDP_ENABLED
+WiFiUDP wr_udp;
+IPAddress wr_udp_peer_ip;
+uint16_t wr_udp_peer_port = 0;
+uint32_t wr_udp_last_read = 0;
+uint8_t wr_udp_rx_buf[WR_TX_BUF_SIZE];
+uint16_t wr_udp_rx_len = 0;
+uint8_t wr_udp_tx_slots[WR_UDP_TX_SLOTS][WR_TX_BUF_SIZE];
+uint16_t wr_udp_tx_lens[WR_UDP_TX_SLOTS];
+uint8_t wr_udp_tx_head = 0;
+uint8_t wr_udp_tx_count = 0;
+#endif
 IPAddress ap_ip(10, 0, 0, 1);
 IPAddress ap_nm(255, 255, 255, 0);
 IPAddress wr_device_ip;
@@ -52,14 +122,42 @@ bool wifi_initialized = false;
 char wr_ssid[33];
 char wr_psk[33];
 
+// Outgoing data is collected here and handed to lwIP
+// as one write per KISS frame, instead of one write
+// per byte. The clients a frame goes to are fixed when
+// it opens, so a client that connects part way through
+// never receives the rest of it.
+#define WR_TX_UDP (1 << WR_MAX_CLIENTS)
+#define WR_TX_ALL 0xFF
+uint8_t wr_tx_buf[WR_TX_BUF_SIZE];
+size_t wr_tx_len = 0;
+bool wr_tx_in_frame = false;
+uint8_t wr_tx_targets = WR_TX_ALL;
+
+// Frames handed to the serial FIFO are tagged with the
+// client they came from, in the same order as their
+// FIFO segments, so replies can go back to that client
+// alone. The UDP peer is tagged as WR_MAX_CLIENTS.
+uint8_t wr_rx_origins[WR_RX_ORIGINS];
+uint8_t wr_rx_origin_head = 0;
+uint8_t wr_rx_origin_count = 0;
+int8_t wr_rx_client = -1;
+
+extern bool mux_replying;
 extern void host_disconnected();
+extern bool buffer_serial_frame(const uint8_t *frame, size_t len);
+extern void host_lock_take();
+extern void host_lock_give();
 
 void wifi_dbg(String msg) { Serial.print("[WiFi] "); Serial.println(msg); }
 
 uint8_t wifi_remote_mode() { return wifi_mode; }
 
 bool wifi_is_connected() { return (wr_wifi_status == WL_CONNECTED); }
-bool wifi_host_is_connected() { if (connection) { return true; } else { return false; } }
+bool wifi_host_is_connected() {
+  for (uint8_t i = 0; i < WR_MAX_CLIENTS; i++) { if (wr_clients[i].active) { return true; } }
+  return wr_udp_active;
+}
 
 void wifi_remote_start_ap() {
   WiFi.mode(WIFI_AP);
@@ -121,8 +219,17 @@ void wifi_remote_start() {
   if (wifi_initialized == true) {
     remote_listener.begin();
     remote_listener.setTimeout(WR_SOCKET_TIMEOUT);
+    #if WR_UDP_ENABLED
+      wr_udp.begin(WR_PORT);
+    #endif
     wr_state = WR_STATE_ON;
-  } else { remote_listener.end(); wr_state = WR_STATE_OFF; }
+  } else {
+    remote_listener.end();
+    #if WR_UDP_ENABLED
+      wr_udp.stop();
+    #endif
+    wr_udp_active = false; wr_state = WR_STATE_OFF;
+  }
 }
 
 void wifi_remote_init() {
@@ -142,71 +249,426 @@ void wifi_remote_init() {
   wifi_init_ran = true;
 }
 
+void wifi_remote_elect_primary() {
+  wr_primary = -1;
+  for (uint8_t i = 0; i < WR_MAX_CLIENTS; i++) {
+    if (wr_clients[i].active) {
+      if (wr_primary == -1 || (int32_t)(wr_clients[i].connected_at-wr_clients[wr_primary].connected_at) < 0) { wr_primary = i; }
+    }
+  }
+}
+
+void wifi_remote_close_client(uint8_t i) {
+  wr_client_t *c = &wr_clients[i];
+  if (c->active) { c->client.stop(); }
+  c->active = false;
+  c->rx_len = 0;
+  c->tx_head = 0; c->tx_len = 0;
+  if (wr_stream_client == i) { wr_stream_client = -1; }
+  if (wr_primary == i) { wifi_remote_elect_primary(); }
+  if (!wifi_host_is_connected()) {
+    wr_tx_len = 0; wr_tx_in_frame = false;
+    wr_state = WR_STATE_ON;
+  }
+}
+
+void wifi_remote_udp_close() {
+  wr_udp_active = false;
+  #if WR_UDP_ENABLED
+    wr_udp_rx_len = 0;
+    wr_udp_tx_count = 0;
+  #endif
+  if (!wifi_host_is_connected()) {
+    wr_tx_len = 0; wr_tx_in_frame = false;
+    wr_state = WR_STATE_ON;
+  }
+}
+
 void wifi_remote_close_all() {
   // wifi_dbg("Close all"); // TODO: Remove debug
-  if (connection) { connection.stop(); }
+  for (uint8_t i = 0; i < WR_MAX_CLIENTS; i++) { wifi_remote_close_client(i); }
+  wifi_remote_udp_close();
   WiFiClient client = remote_listener.available();
   while (client) { client.stop(); client = remote_listener.available(); }
+  wr_primary = -1;
+  wr_tx_len = 0; wr_tx_in_frame = false;
   wr_state = WR_STATE_ON;
 }
 
-void wifi_remote_check_active() {
-  if (millis()-wr_last_read >= WR_READ_TIMEOUT_MS) {
-    // wifi_dbg("Connection activity timed out"); // TODO: Remove debug
-    if (connection && connection.connected()) {
-      connection.stop();
-      wifi_remote_close_all();
-      host_disconnected();
+#if WR_UDP_ENABLED
+void wifi_remote_udp_send() {
+  while (wr_udp_active && wr_udp_tx_count > 0) {
+    wr_udp.beginPacket(wr_udp_peer_ip, wr_udp_peer_port);
+    wr_udp.write(wr_udp_tx_slots[wr_udp_tx_head], wr_udp_tx_lens[wr_udp_tx_head]);
+    if (!wr_udp.endPacket()) { break; }
+    wr_udp_tx_head = (wr_udp_tx_head+1)%WR_UDP_TX_SLOTS;
+    wr_udp_tx_count--;
+  }
+}
+
+void wifi_remote_udp_queue(const uint8_t *frame, size_t len) {
+  if (wr_udp_tx_count == WR_UDP_TX_SLOTS) {
+    wr_udp_tx_head = (wr_udp_tx_head+1)%WR_UDP_TX_SLOTS;
+    wr_udp_tx_count--;
+  }
+  uint8_t slot = (wr_udp_tx_head+wr_udp_tx_count)%WR_UDP_TX_SLOTS;
+  memcpy(wr_udp_tx_slots[slot], frame, len);
+  wr_udp_tx_lens[slot] = len;
+  wr_udp_tx_count++;
+}
+#endif
+
+// Hands as much of the client TX ring to the socket as
+// it accepts without blocking.
+void wifi_remote_send(uint8_t i) {
+  wr_client_t *c = &wr_clients[i];
+  while (c->active && c->tx_len > 0) {
+    size_t span = WR_CLIENT_TX_SIZE - c->tx_head;
+    if (span > c->tx_len) { span = c->tx_len; }
+    int sent = send(c->client.fd(), c->tx_buf+c->tx_head, span, MSG_DONTWAIT);
+    if (sent < 0) {
+      if (errno != EAGAIN && errno != EWOULDBLOCK) { wifi_remote_close_client(i); wr_client_dropped = true; }
+      return;
     }
+    if (sent == 0) { return; }
+    c->tx_head = (c->tx_head+sent)%WR_CLIENT_TX_SIZE;
+    c->tx_len -= sent;
   }
 }
 
-bool wifi_remote_available() {
-  if (connection) {
-    if (connection.connected()) {
-      if (connection.available()) { wr_last_read = millis(); return true; }
-      else                        { wifi_remote_check_active(); return false; }
-    } else {
-      // wifi_dbg("Client disconnected"); // TODO: Remove debug
-      wifi_remote_close_all();
-      return false;
+// Adds data to the client TX ring. A client that has
+// fallen so far behind that it does not fit is dropped.
+void wifi_remote_queue(uint8_t i, const uint8_t *data, size_t len) {
+  wr_client_t *c = &wr_clients[i];
+  if (len > WR_CLIENT_TX_SIZE - c->tx_len) {
+    wifi_remote_close_client(i);
+    wr_client_dropped = true;
+    return;
+  }
+  uint16_t tail = (c->tx_head+c->tx_len)%WR_CLIENT_TX_SIZE;
+  while (len > 0) {
+    size_t span = WR_CLIENT_TX_SIZE - tail;
+    if (span > len) { span = len; }
+    memcpy(c->tx_buf+tail, data, span);
+    tail = (tail+span)%WR_CLIENT_TX_SIZE;
+    c->tx_len += span;
+    data += span; len -= span;
+  }
+  wifi_remote_send(i);
+}
+
+void wifi_remote_flush() {
+  if (wr_tx_len > 0) {
+    for (uint8_t i = 0; i < WR_MAX_CLIENTS; i++) {
+      if (wr_clients[i].active && (wr_tx_targets & (1 << i))) { wifi_remote_queue(i, wr_tx_buf, wr_tx_len); }
     }
-  } else {
-    WiFiClient client = remote_listener.available();
-    if (!client) { return false; }
+    #if WR_UDP_ENABLED
+      if (wr_udp_active && (wr_tx_targets & WR_TX_UDP)) { wifi_remote_udp_queue(wr_tx_buf, wr_tx_len); }
+    #endif
+    wr_tx_len = 0;
+    #if WR_UDP_ENABLED
+      wifi_remote_udp_send();
+    #endif
+  }
+}
+
+// Everything the device sends to the host is fanned
+// out to all connected clients from the same buffer,
+// except replies, which go only to the client that
+// sent the command.
+void wifi_remote_write(uint8_t byte) {
+  if (wr_state == WR_STATE_CONNECTED) {
+    if (byte == FEND && !wr_tx_in_frame) {
+      wr_tx_targets = (mux_replying && wr_rx_client != -1) ? (1 << wr_rx_client) : WR_TX_ALL;
+    }
+    wr_tx_buf[wr_tx_len++] = byte;
+    if (byte == FEND) {
+      if (wr_tx_in_frame) { wifi_remote_flush(); wr_tx_in_frame = false; }
+      else                { wr_tx_in_frame = true; }
+    }
+    if (wr_tx_len >= WR_TX_BUF_SIZE) { wifi_remote_flush(); }
+  }
+}
+
+void wifi_remote_accept() {
+  WiFiClient client = remote_listener.available();
+  while (client) {
+    int8_t slot = -1;
+    for (uint8_t i = 0; i < WR_MAX_CLIENTS; i++) { if (!wr_clients[i].active) { slot = i; break; } }
+
+    if (slot == -1) { client.stop(); }
     else {
       // wifi_dbg("Client connected"); // TODO: Remove debug
-      connection = client;
+      // The new client only joins at the next frame, so
+      // it never receives the tail of a partial one.
+      wr_tx_targets &= ~(1 << slot);
+      wr_client_t *c = &wr_clients[slot];
+      c->client = client;
+      c->client.setNoDelay(true);
+      c->active = true;
+      c->rx_len = 0;
+      c->tx_head = 0; c->tx_len = 0;
+      c->connected_at = millis();
+      c->last_read = c->connected_at;
+      if (wr_primary == -1) { wr_primary = slot; }
       wr_state = WR_STATE_CONNECTED;
-      wr_last_read = millis();
-      if (connection.available()) { return true; }
-      else                        { return false; }
     }
+
+    client = remote_listener.available();
   }
 }
 
-uint8_t wifi_remote_read() {
-  if (connection && connection.available()) { return connection.read(); }
-  else {
+// Every client must stay active, so half-open sockets
+// cannot hold on to slots. The radio is only stopped
+// once no host at all is left.
+void wifi_remote_check_active() {
+  bool dropped = wr_client_dropped;
+  wr_client_dropped = false;
+  for (uint8_t i = 0; i < WR_MAX_CLIENTS; i++) {
+    wr_client_t *c = &wr_clients[i];
+    if (c->active && millis()-c->last_read >= WR_READ_TIMEOUT_MS) {
+      // wifi_dbg("Connection activity timed out"); // TODO: Remove debug
+      wifi_remote_close_client(i);
+      dropped = true;
+    }
+  }
+  if (dropped && !wifi_host_is_connected()) { host_disconnected(); }
+}
+
+// Reads whatever the socket has ready into the free
+// part of the client staging buffer, without blocking.
+void wifi_remote_fill(uint8_t i) {
+  wr_client_t *c = &wr_clients[i];
+  size_t space = WR_CLIENT_BUF_SIZE - c->rx_len;
+  if (space == 0) { return; }
+
+  int ready = c->client.available();
+  if (ready <= 0) { return; }
+  if ((size_t)ready < space) { space = ready; }
+
+  int read = c->client.read(c->rx_buf+c->rx_len, space);
+  if (read <= 0) {
     // wifi_dbg("Error: No data to read from TCP socket"); // TODO: Remove debug
-    if (connection) { wifi_remote_close_all(); }
-    return 0xC0;
+    wifi_remote_close_client(i);
+    return;
+  }
+
+  c->rx_len += read;
+  c->last_read = millis();
+}
+
+// Commands that secondary clients may issue. These only
+// query state, or subscribe to reports on the WiFi
+// port. Anything else that changes radio or device
+// state is reserved for the primary client.
+bool wifi_remote_cmd_allowed(const uint8_t *frame, size_t len) {
+  uint8_t cmd = frame[1];
+  uint8_t arg = (len > 2) ? frame[2] : 0x00;
+  if (arg == FESC && len > 3) { arg = (frame[3] == TFEND) ? FEND : FESC; }
+  if (cmd == CMD_PROF_STATS) { return !(arg & PROF_RESET); }
+  if (cmd == CMD_FB_BULK)    { return (arg & FB_BULK_READ); }
+  if (cmd == CMD_STAT_BLE)   { return arg == 0xFF; }
+  return (cmd == CMD_DATA       || cmd == CMD_DETECT    || cmd == CMD_READY     ||
+          cmd == CMD_STAT_RX    || cmd == CMD_STAT_TX   || cmd == CMD_STAT_RSSI ||
+          cmd == CMD_FW_VERSION || cmd == CMD_PLATFORM  || cmd == CMD_MCU       ||
+          cmd == CMD_BOARD      || cmd == CMD_MUX_DSCVR || cmd == CMD_BOOT_PROF ||
+          cmd == CMD_TELEMETRY  || cmd == CMD_FB_READ   || cmd == CMD_DISP_READ);
+}
+
+// Hands a frame, or a piece of a streamed one, to the
+// serial FIFO and records which client it came from.
+bool wifi_remote_buffer(uint8_t origin, const uint8_t *frame, size_t len) {
+  if (wr_rx_origin_count == WR_RX_ORIGINS || !buffer_serial_frame(frame, len)) { return false; }
+  wr_rx_origins[(wr_rx_origin_head+wr_rx_origin_count)%WR_RX_ORIGINS] = origin;
+  wr_rx_origin_count++;
+  return true;
+}
+
+// Called as each WiFi segment is taken from the FIFO
+void wifi_remote_rx_origin() {
+  wr_rx_client = -1;
+  if (wr_rx_origin_count > 0) {
+    wr_rx_client = wr_rx_origins[wr_rx_origin_head];
+    wr_rx_origin_head = (wr_rx_origin_head+1)%WR_RX_ORIGINS;
+    wr_rx_origin_count--;
   }
 }
 
-void wifi_remote_write(uint8_t byte) { if (connection) { connection.write(byte); } }
+// Tells a secondary client that its command was not
+// carried out
+void wifi_remote_reject(uint8_t i) {
+  const uint8_t nack[4] = {FEND, CMD_ERROR, ERROR_NOT_ALLOWED, FEND};
+  wifi_remote_queue(i, nack, sizeof(nack));
+}
+
+// Hands the next complete frame in the staging buffer
+// of client i to the serial FIFO. Returns true if a
+// frame was consumed.
+bool wifi_remote_deliver(uint8_t i) {
+  wr_client_t *c = &wr_clients[i];
+  if (wr_stream_client != -1) {
+    if (wr_stream_client != i || c->rx_len == 0) { return false; }
+    uint16_t e = 0;
+    while (e < c->rx_len && c->rx_buf[e] != FEND) { e++; }
+    uint16_t len = (e < c->rx_len) ? e+1 : c->rx_len;
+    if (wr_stream_allowed && !wifi_remote_buffer(i, c->rx_buf, len)) { return false; }
+    if (e < c->rx_len) {
+      // Keep the closing FEND, as below
+      memmove(c->rx_buf, c->rx_buf+e, c->rx_len-e);
+      c->rx_len -= e;
+      wr_stream_client = -1;
+    } else { c->rx_len = 0; }
+    return true;
+  }
+
+  uint16_t s = 0;
+  while (s < c->rx_len && (c->rx_buf[s] != FEND || (s+1 < c->rx_len && c->rx_buf[s+1] == FEND))) { s++; }
+  if (s > 0) { memmove(c->rx_buf, c->rx_buf+s, c->rx_len-s); c->rx_len -= s; }
+
+  uint16_t e = 1;
+  while (e < c->rx_len && c->rx_buf[e] != FEND) { e++; }
+  if (e >= c->rx_len) {
+    // A frame that fills the whole staging buffer is
+    // passed on as it is, and the rest of it follows
+    // as it arrives.
+    if (c->rx_len == WR_CLIENT_BUF_SIZE) {
+      bool allowed = (i == wr_primary || wifi_remote_cmd_allowed(c->rx_buf, c->rx_len));
+      if (allowed && !wifi_remote_buffer(i, c->rx_buf, c->rx_len)) { return false; }
+      if (!allowed) { wifi_remote_reject(i); }
+      wr_stream_client = i;
+      wr_stream_allowed = allowed;
+      c->rx_len = 0;
+      return true;
+    }
+    return false;
+  }
+
+  if (i == wr_primary || wifi_remote_cmd_allowed(c->rx_buf, e+1)) {
+    if (!wifi_remote_buffer(i, c->rx_buf, e+1)) { return false; }
+  } else {
+    wifi_remote_reject(i);
+  }
+
+  // Keep the closing FEND, since it may also open
+  // the next frame
+  memmove(c->rx_buf, c->rx_buf+e, c->rx_len-e);
+  c->rx_len -= e;
+  return true;
+}
+
+#if WR_UDP_ENABLED
+// Hands the pending UDP datagram to the serial FIFO.
+// Datagrams that are not a single well-formed frame,
+// or that carry a command the peer may not issue, are
+// discarded. If the FIFO is full, the datagram is kept
+// until the next attempt, or until a newer datagram
+// replaces it.
+void wifi_remote_udp_deliver() {
+  if (wr_udp_rx_len == 0 || wr_stream_client != -1) { return; }
+
+  uint8_t *f = wr_udp_rx_buf; uint16_t l = wr_udp_rx_len;
+  bool valid = (l >= 3 && f[0] == FEND && f[l-1] == FEND && f[1] != FEND);
+  for (uint16_t i = 1; valid && i < l-1; i++) { if (f[i] == FEND) { valid = false; } }
+  bool allowed = (wr_primary == -1 || wifi_remote_cmd_allowed(f, l));
+
+  if (valid && !allowed) {
+    const uint8_t nack[4] = {FEND, CMD_ERROR, ERROR_NOT_ALLOWED, FEND};
+    wifi_remote_udp_queue(nack, sizeof(nack));
+  }
+  if (!valid || !allowed || wifi_remote_buffer(WR_MAX_CLIENTS, f, l)) { wr_udp_rx_len = 0; }
+}
+
+void wifi_remote_udp_receive() {
+  wifi_remote_udp_deliver();
+
+  uint8_t n = 0; int size;
+  while (n++ < WR_UDP_RX_BURST && (size = wr_udp.parsePacket()) > 0) {
+    if (size > WR_TX_BUF_SIZE) { continue; }
+    IPAddress ip = wr_udp.remoteIP();
+    uint16_t port = wr_udp.remotePort();
+    bool from_peer = (wr_udp_active && ip == wr_udp_peer_ip && port == wr_udp_peer_port);
+
+    uint8_t *buf = wr_udp_rx_buf;
+    uint8_t head[3];
+    if (!from_peer) { buf = head; size = 3; }
+    int read = wr_udp.read(buf, size);
+
+    if (!from_peer) {
+      // Only a detect request can register a new peer,
+      // and only while no other peer is registered.
+      if (wr_udp_active || read < 3 || head[0] != FEND || head[1] != CMD_DETECT || head[2] != DETECT_REQ) { continue; }
+      wr_tx_targets &= ~WR_TX_UDP;
+      wr_udp_peer_ip = ip;
+      wr_udp_peer_port = port;
+      wr_udp_tx_count = 0;
+      wr_udp_active = true;
+      wr_state = WR_STATE_CONNECTED;
+      memcpy(wr_udp_rx_buf, head, 3);
+      wr_udp_rx_buf[3] = FEND;
+      read = 4;
+    }
+
+    wr_udp_last_read = millis();
+    if (read > 0) { wr_udp_rx_len = read; wifi_remote_udp_deliver(); }
+  }
+}
+
+void wifi_remote_udp_check_active() {
+  if (wr_udp_active && millis()-wr_udp_last_read >= WR_READ_TIMEOUT_MS) {
+    wifi_remote_udp_close();
+    if (!wifi_host_is_connected()) { host_disconnected(); }
+  }
+}
+#endif
+
+void wifi_remote_service() {
+  wifi_remote_accept();
+  #if WR_UDP_ENABLED
+    wifi_remote_udp_receive();
+    wifi_remote_udp_send();
+    wifi_remote_udp_check_active();
+  #endif
+
+  for (uint8_t i = 0; i < WR_MAX_CLIENTS; i++) {
+    if (wr_clients[i].active) {
+      if (!wr_clients[i].client.connected()) {
+        // wifi_dbg("Client disconnected"); // TODO: Remove debug
+        wifi_remote_close_client(i);
+      } else {
+        wifi_remote_send(i);
+        wifi_remote_fill(i);
+      }
+    }
+  }
+
+  wifi_remote_check_active();
+
+  // Take at most one frame from each client per round,
+  // so a busy host cannot starve the others of space
+  // in the packet queue.
+  bool delivered = true;
+  while (delivered) {
+    delivered = false;
+    for (uint8_t n = 0; n < WR_MAX_CLIENTS; n++) {
+      uint8_t i = (wr_rr_next+n)%WR_MAX_CLIENTS;
+      if (wr_clients[i].active && wifi_remote_deliver(i)) { delivered = true; }
+    }
+    wr_rr_next = (wr_rr_next+1)%WR_MAX_CLIENTS;
+  }
+}
 
 void wifi_update_status() {
   wr_wifi_status = WiFi.status();
   if (wr_wifi_status == WL_CONNECTED) { wr_device_ip = WiFi.localIP(); }
   if (wifi_mode == WR_WIFI_AP && wifi_initialized) { wr_device_ip = WiFi.softAPIP(); wr_wifi_status = WL_CONNECTED; }
   if (wifi_init_ran && wifi_mode == WR_WIFI_STA && wr_wifi_status != WL_CONNECTED) {
-    if (millis()-wr_last_connect_try >= WR_RECONNECT_INTERVAL_MS) { wifi_remote_init(); }
+    if (millis()-wr_last_connect_try >= WR_RECONNECT_INTERVAL_MS) { host_lock_take(); wifi_remote_init(); host_lock_give(); }
   }
 }
 
 void update_wifi() {
   if (millis()-last_wifi_update >= wifi_update_interval_ms) {
+    host_lock_take(); wifi_remote_flush(); host_lock_give();
     wifi_update_status();
     last_wifi_update = millis();
   }
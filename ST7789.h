@@ -106,6 +106,13 @@ class ST7789Spi : public OLEDDisplay {
       SPISettings           _spiSettings;
       uint16_t            _RGB=0xFFFF;
       uint8_t             _buffheight;
+      // Two RGB565 stripes of one buffer page each. One
+      // is converted while the other is being sent.
+      uint16_t           *_stripe[2] = {NULL, NULL};
+#if defined(NRF52_SERIES)
+      NRF_SPIM_Type      *_spim = NULL;
+      volatile bool       _dma_busy = false;
+#endif
   public:
     /* pass _cs as -1 to indicate "do not use CS pin", for cases where it is hard wired low */
     ST7789Spi(SPIClass *spiClass,uint8_t _rst, uint8_t _dc, uint8_t _cs, OLEDDISPLAY_GEOMETRY g = GEOMETRY_RAWMODE,uint16_t width=240,uint16_t height=320,int mosi=-1,int miso=-1,int clk=-1) {
@@ -183,30 +190,72 @@ class ST7789Spi : public OLEDDisplay {
        // holdes true for all values of pos
        if (minBoundY == UINT16_MAX) return;
 
-          set_CS(LOW);
-          _spi->beginTransaction(_spiSettings);
-
-          for (y = minBoundY; y <= maxBoundY; y++)
-          {
-            for(int temp = 0; temp<8;temp++)
-            {
-              //setAddrWindow(minBoundX,y*8+temp,maxBoundX-minBoundX+1,1);
-              setAddrWindow(minBoundX,y*8+temp,maxBoundX-minBoundX+1,1);
-              //setAddrWindow(y*8+temp,minBoundX,1,maxBoundX-minBoundX+1);
-              uint32_t const pixbufcount = maxBoundX-minBoundX+1;
-              uint16_t *pixbuf = (uint16_t *)rtos_malloc(2 * pixbufcount);
-              for (x = minBoundX; x <= maxBoundX; x++)
-              {
-                pixbuf[x-minBoundX] = ((buffer[x + y * displayWidth]>>temp)&0x01)==1?_RGB:0;
-              }
+       if (_stripe[0] == NULL) _stripe[0] = (uint16_t *)rtos_malloc(2 * displayWidth * 8);
+       if (_stripe[1] == NULL) _stripe[1] = (uint16_t *)rtos_malloc(2 * displayWidth * 8);
+
+       // Without the stripe buffers, fall back to writing
+       // the dirty box one blocking row at a time
+       if (_stripe[0] == NULL || _stripe[1] == NULL) {
+         uint32_t const pixbufcount = maxBoundX-minBoundX+1;
+         uint16_t *pixbuf = (uint16_t *)rtos_malloc(2 * pixbufcount);
+         if (pixbuf == NULL) {
+           // Keep the box dirty so the next call retries it
+           for (y = minBoundY; y <= maxBoundY; y++) {
+             for (x = minBoundX; x <= maxBoundX; x++) {
+               buffer_back[x + y * displayWidth] = ~buffer[x + y * displayWidth];
+             }
+           }
+           return;
+         }
+
+         set_CS(LOW);
+         _spi->beginTransaction(_spiSettings);
+         for (y = minBoundY; y <= maxBoundY; y++) {
+           for (int temp = 0; temp < 8; temp++) {
+             setAddrWindow(minBoundX, y*8+temp, pixbufcount, 1);
+             for (x = minBoundX; x <= maxBoundX; x++) {
+               pixbuf[x-minBoundX] = ((buffer[x + y * displayWidth]>>temp)&0x01)==1?_RGB:0;
+             }
 #ifdef ESP_PLATFORM
-              _spi->transferBytes((uint8_t *)pixbuf, NULL, 2 * pixbufcount);
+             _spi->transferBytes((uint8_t *)pixbuf, NULL, 2 * pixbufcount);
 #else
-              _spi->transfer(pixbuf, NULL, 2 * pixbufcount);
+             _spi->transfer(pixbuf, NULL, 2 * pixbufcount);
 #endif
-              rtos_free(pixbuf);
-            }
-          }
+           }
+         }
+         _spi->endTransaction();
+         set_CS(HIGH);
+         rtos_free(pixbuf);
+         return;
+       }
+
+       // The whole dirty box is written through one
+       // address window, one page stripe at a time
+       uint16_t const w = maxBoundX-minBoundX+1;
+       uint16_t const y0 = minBoundY*8;
+       uint16_t y1 = maxBoundY*8+8;
+       if (y1 > displayHeight) y1 = displayHeight;
+
+       set_CS(LOW);
+       _spi->beginTransaction(_spiSettings);
+       setAddrWindow(minBoundX, y0, w, y1-y0);
+
+       uint8_t s = 0;
+       for (y = minBoundY; y <= maxBoundY; y++) {
+         uint16_t *pixbuf = _stripe[s];
+         uint16_t rows = 0;
+         for (uint8_t temp = 0; temp < 8 && y*8+temp < y1; temp++) {
+           uint8_t *page = buffer + y * displayWidth;
+           for (x = minBoundX; x <= maxBoundX; x++) {
+             *pixbuf++ = ((page[x]>>temp)&0x01)==1?_RGB:0;
+           }
+           rows++;
+         }
+         writeStripe(_stripe[s], 2 * w * rows);
+         s ^= 1;
+       }
+       waitStripe();
+
       _spi->endTransaction();
       set_CS(HIGH);
 
@@ -272,6 +321,24 @@ class ST7789Spi : public OLEDDisplay {
     delay(10);
   }
 
+  // Monochrome page buffer, for callers that blit
+  // directly instead of going through setPixel.
+  uint8_t *getBuffer() { return buffer; }
+
+  // Sends stripes with SPIM EasyDMA instead of through
+  // SPIClass, if the SPIM driving the given SCK pin
+  // can be found. The next stripe is then converted
+  // while the previous one is still being sent.
+  void useDMA(uint8_t sck_pin) {
+#if defined(NRF52_SERIES)
+    NRF_SPIM_Type *spims[] = {NRF_SPIM0, NRF_SPIM1, NRF_SPIM2, NRF_SPIM3};
+    for (uint8_t i = 0; i < 4; i++) {
+      if (spims[i]->ENABLE == (SPIM_ENABLE_ENABLE_Enabled << SPIM_ENABLE_ENABLE_Pos) &&
+          (spims[i]->PSEL.SCK & 0x3F) == g_ADigitalPinMap[sck_pin]) { _spim = spims[i]; }
+    }
+#endif
+  }
+
   void setRGB(uint16_t c)
   {
 
@@ -356,6 +423,38 @@ class ST7789Spi : public OLEDDisplay {
 
     writeCommand(ST77XX_RAMWR); // write to RAM
   }
+    void writeStripe(uint16_t *stripe, uint32_t len) {
+#if defined(NRF52_SERIES)
+      if (_spim != NULL) {
+        waitStripe();
+        _spim->TXD.PTR = (uint32_t)stripe;
+        _spim->TXD.MAXCNT = len;
+        _spim->TXD.LIST = 0;
+        _spim->RXD.PTR = 0;
+        _spim->RXD.MAXCNT = 0;
+        _spim->EVENTS_END = 0;
+        _spim->TASKS_START = 1;
+        _dma_busy = true;
+        return;
+      }
+#endif
+#ifdef ESP_PLATFORM
+      _spi->transferBytes((uint8_t *)stripe, NULL, len);
+#else
+      _spi->transfer(stripe, NULL, len);
+#endif
+    }
+
+    void waitStripe() {
+#if defined(NRF52_SERIES)
+      if (_dma_busy) {
+        while (!_spim->EVENTS_END) { yield(); }
+        _spim->EVENTS_END = 0;
+        _dma_busy = false;
+      }
+#endif
+    }
+
     int getBufferOffset(void) {
         return 0;
     }
@@ -23,9 +23,14 @@
     #include <InternalFileSystem.h>
     using namespace Adafruit_LittleFS_Namespace;
     #define EEPROM_FILE "eeprom"
-    bool file_exists = false;
-    int written_bytes = 4;
+    #define EEPROM_TMP_FILE "eeprom.tmp"
     File file(InternalFS);
+    // The EEPROM file is mirrored in RAM. Reads come from
+    // the mirror, and changes are written back as a whole
+    // new file that is renamed over the old one, so an
+    // interrupted commit leaves the previous image intact.
+    uint8_t eeprom_image[EEPROM_SIZE];
+    bool eeprom_dirty = false;
 #endif
 #include <stddef.h>
 
@@ -43,9 +48,22 @@ sx128x *LoRa = &sx128x_modem;
 #include "ROM.h"
 #include "Framing.h"
 #include "MD5.h"
+#include "Profiling.h"
 
 #if !HAS_EEPROM && MCU_VARIANT == MCU_NRF52
 uint8_t eeprom_read(uint32_t mapped_addr);
+void eeprom_flush();
+#endif
+
+#if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+	// Held around PMU and display transfers, which can
+	// share one I2C bus from different tasks.
+	SemaphoreHandle_t wire_lock = NULL;
+	void wire_lock_take() { if (wire_lock != NULL) xSemaphoreTake(wire_lock, portMAX_DELAY); }
+	void wire_lock_give() { if (wire_lock != NULL) xSemaphoreGive(wire_lock); }
+#else
+	void wire_lock_take() { }
+	void wire_lock_give() { }
 #endif
 
 #if HAS_DISPLAY == true
@@ -374,7 +392,14 @@ uint8_t boot_vector = 0x00;
 	#endif
 #endif
 
+#if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+	void warm_state_save();
+#endif
+
 void hard_reset(void) {
+	#if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+		warm_state_save();
+	#endif
 	#if MCU_VARIANT == MCU_1284P || MCU_VARIANT == MCU_2560
 		wdt_enable(WDTO_15MS);
 		while(true) {
@@ -798,23 +823,169 @@ int8_t  led_standby_direction = 0;
 	#endif
 #endif
 
-void serial_write(uint8_t byte) {
-	#if HAS_BLUETOOTH || HAS_BLE == true
-		if (bt_state != BT_STATE_CONNECTED) {
-			#if HAS_WIFI
-				if (wifi_host_is_connected()) { wifi_remote_write(byte); }
-				else                          { Serial.write(byte); }
-			#else
-				Serial.write(byte);
-			#endif
+#if HAS_HOST_MUX
+	// Host connection multiplexer. USB, Bluetooth and
+	// WiFi hosts can be attached at the same time, and
+	// each port keeps its own KISS parser state and its
+	// own subscription to unsolicited frames.
+	#define MUX_UNSUBSCRIBE     0x00
+	#define MUX_SUBSCRIBE       0x01
+	#define MUX_QUERY           0xFF
+
+	#define MUX_FLAG_ATTACHED   0x01
+	#define MUX_FLAG_SUBSCRIBED 0x02
+	#define MUX_FLAG_REQUESTER  0x04
+
+	typedef struct {
+		size_t frame_len;
+		bool in_frame;
+		bool escape;
+		uint8_t command;
+		uint8_t cmdbuf[CMD_L];
+		uint16_t dlen;
+		uint8_t dbuf[MTU];
+		bool seen;
+		bool subscribed;
+	} mux_port_t;
+
+	mux_port_t mux_ports[MUX_PORTS];
+	uint8_t mux_rx_port = MUX_PORT_USB;
+	bool mux_replying = false;
+	uint8_t mux_tx_mask = 0;
+	uint8_t mux_tx_filter = HOST_PORTS_ALL;
+	bool mux_tx_in_frame = false;
+
+	#define host_via_bt() (mux_rx_port == MUX_PORT_BT)
+	#define host_via_usb() (mux_rx_port == MUX_PORT_USB)
+	#define host_port() (mux_rx_port)
+
+	void mux_init() {
+		memset(mux_ports, 0, sizeof(mux_ports));
+		for (uint8_t p = 0; p < MUX_PORTS; p++) {
+			mux_ports[p].command = CMD_UNKNOWN;
+			mux_ports[p].subscribed = true;
+		}
+		mux_rx_port = MUX_PORT_USB;
+	}
+
+	// The framing globals always hold the state of the
+	// port currently being parsed, and are swapped out
+	// only when bytes from another port arrive.
+	void mux_select_port(uint8_t port) {
+		if (port == mux_rx_port || port >= MUX_PORTS) { return; }
+		mux_port_t *cur = &mux_ports[mux_rx_port];
+		cur->frame_len = frame_len; cur->in_frame = IN_FRAME; cur->escape = ESCAPE; cur->command = command;
+		memcpy(cur->cmdbuf, cmdbuf, CMD_L);
+
+		mux_port_t *next = &mux_ports[port];
+		frame_len = next->frame_len; IN_FRAME = next->in_frame; ESCAPE = next->escape; command = next->command;
+		memcpy(cmdbuf, next->cmdbuf, CMD_L);
+		mux_rx_port = port;
+	}
+
+	bool mux_port_attached(uint8_t port) {
+		#if HAS_BLUETOOTH || HAS_BLE == true
+			if (port == MUX_PORT_BT) { return bt_state == BT_STATE_CONNECTED; }
+		#endif
+		#if HAS_WIFI
+			if (port == MUX_PORT_WIFI) { return wifi_host_is_connected(); }
+		#endif
+		if (port == MUX_PORT_USB) {
+			// USB has no connection state of its own, so it is
+			// considered attached once a host has spoken on it,
+			// or when no other host is attached at all.
+			if (mux_ports[MUX_PORT_USB].seen) { return true; }
+			for (uint8_t p = 1; p < MUX_PORTS; p++) { if (mux_port_attached(p)) { return false; } }
+			return true;
+		}
+		return false;
+	}
+
+	uint8_t mux_port_flags(uint8_t port) {
+		uint8_t flags = 0x00;
+		if (mux_port_attached(port))      { flags |= MUX_FLAG_ATTACHED; }
+		if (mux_ports[port].subscribed)   { flags |= MUX_FLAG_SUBSCRIBED; }
+		if (mux_replying && port == mux_rx_port) { flags |= MUX_FLAG_REQUESTER; }
+		return flags;
+	}
+
+	// Replies go only to the port that sent the command,
+	// everything else goes to all subscribed ports.
+	uint8_t mux_tx_targets() {
+		uint8_t mask = 0x00;
+		if (mux_replying) {
+			if (mux_port_attached(mux_rx_port)) { mask = 1 << mux_rx_port; }
 		} else {
-			SerialBT.write(byte);
-      #if MCU_VARIANT == MCU_NRF52 && HAS_BLE
-	      // This ensures that the TX buffer is flushed after a frame is queued in serial.
-	      // serial_in_frame is used to ensure that the flush only happens at the end of the frame
-	      if (serial_in_frame && byte == FEND) { SerialBT.flushTXD(); serial_in_frame = false; }
-	      else if (!serial_in_frame && byte == FEND) { serial_in_frame = true; }
-      #endif
+			for (uint8_t p = 0; p < MUX_PORTS; p++) {
+				if (mux_ports[p].subscribed && mux_port_attached(p)) { mask |= 1 << p; }
+			}
+		}
+		return mask & mux_tx_filter;
+	}
+
+	void mux_port_write(uint8_t port, uint8_t byte) {
+		if (port == MUX_PORT_USB) { Serial.write(byte); }
+		#if (MCU_VARIANT == MCU_NRF52 && HAS_BLE) || HAS_BLUETOOTH
+			else if (port == MUX_PORT_BT) { bt_write(byte); }
+		#elif HAS_BLUETOOTH || HAS_BLE == true
+			else if (port == MUX_PORT_BT) { SerialBT.write(byte); }
+		#endif
+		#if HAS_WIFI
+			else if (port == MUX_PORT_WIFI) { wifi_remote_write(byte); }
+		#endif
+	}
+#else
+	#define host_via_bt() (bt_state == BT_STATE_CONNECTED)
+	#define host_via_usb() (true)
+	#define host_port() (0)
+#endif
+
+// Limits the frames written until host_tx_all() to the
+// host ports in mask, for frames whose format depends
+// on what each host asked for. Returns false if none of
+// those ports would receive anything.
+bool host_tx_only(uint8_t mask) {
+	#if HAS_HOST_MUX
+		mux_tx_filter = mask & HOST_PORTS_ALL;
+		return mux_tx_targets() != 0x00;
+	#else
+		return (mask & HOST_PORTS_ALL) != 0x00;
+	#endif
+}
+
+void host_tx_all() {
+	#if HAS_HOST_MUX
+		mux_tx_filter = HOST_PORTS_ALL;
+	#endif
+}
+
+uint8_t host_rx_ext_mask() {
+	uint8_t mask = 0x00;
+	for (uint8_t p = 0; p < HOST_PORTS; p++) { if (rx_ext[p]) { mask |= 1 << p; } }
+	return mask;
+}
+
+void serial_write(uint8_t byte) {
+	#if HAS_HOST_MUX
+		// Destinations are fixed at the opening FEND, so a
+		// frame is never cut short if a host attaches or
+		// leaves while it is being written.
+		if (!mux_tx_in_frame) { mux_tx_mask = mux_tx_targets(); }
+		for (uint8_t p = 0; p < MUX_PORTS; p++) {
+			if (mux_tx_mask & (1 << p)) { mux_port_write(p, byte); }
+		}
+
+		if (byte == FEND) {
+			if (mux_tx_in_frame) {
+				#if HAS_BLUETOOTH || HAS_BLE == true
+					// Flush the BT TX buffer once a complete frame is
+					// queued, so it leaves in as few packets as possible
+					if (mux_tx_mask & (1 << MUX_PORT_BT)) { bt_flush(); }
+				#endif
+				mux_tx_in_frame = false;
+			} else {
+				mux_tx_in_frame = true;
+			}
 		}
 	#else
 		Serial.write(byte);
@@ -876,6 +1047,13 @@ void kiss_indicate_stat_rssi() {
 	serial_write(FEND);
 }
 
+void kiss_indicate_rx_ext() {
+	serial_write(FEND);
+	serial_write(CMD_DATA_EXT);
+	serial_write(rx_ext[host_port()]);
+	serial_write(FEND);
+}
+
 void kiss_indicate_stat_snr() {
 	serial_write(FEND);
 	serial_write(CMD_STAT_SNR);
@@ -928,6 +1106,91 @@ void kiss_indicate_bandwidth() {
 	serial_write(FEND);
 }
 
+#if HAS_HOST_BAUD
+	void kiss_indicate_host_baud(uint32_t baud) {
+		serial_write(FEND);
+		serial_write(CMD_HOST_BAUD);
+		escaped_serial_write(baud>>24);
+		escaped_serial_write(baud>>16);
+		escaped_serial_write(baud>>8);
+		escaped_serial_write(baud);
+		serial_write(FEND);
+	}
+
+	uint32_t host_baud_last_valid = 0;
+	uint32_t host_baud_frame_start = 0;
+	uint16_t host_baud_noise = 0;
+	bool host_baud_probation = false;
+	bool host_baud_in_frame = false;
+
+	bool host_baud_supported(uint32_t baud) {
+		return baud == serial_baudrate || baud == 460800 || baud == 921600 || baud == 2000000;
+	}
+
+	void host_baud_set(uint32_t baud) {
+		Serial.flush();
+		#if !HOST_NATIVE_USB
+			Serial.updateBaudRate(baud);
+		#endif
+		host_baudrate = baud;
+		host_baud_last_valid = millis();
+		host_baud_noise = 0;
+		host_baud_in_frame = false;
+		host_baud_probation = (baud != serial_baudrate);
+	}
+
+	// Handles a rate proposal from the host. The ack is
+	// sent at the current rate before switching, and a
+	// rejected proposal is answered with the current rate.
+	void host_baud_request(uint32_t baud) {
+		if (baud == 0 || !host_via_usb() || !host_baud_supported(baud)) {
+			kiss_indicate_host_baud(host_baudrate);
+		} else {
+			kiss_indicate_host_baud(baud);
+			host_baud_set(baud);
+		}
+	}
+
+	// Called for every byte parsed from the host, before
+	// it changes the framing state. Only bytes outside of
+	// any frame count as noise, so a host that idles and
+	// then sends is never mistaken for a wrong rate.
+	void host_baud_rx(uint8_t sbyte) {
+		if (host_baudrate == serial_baudrate || !host_via_usb()) { return; }
+		if (sbyte == FEND) {
+			if (IN_FRAME && command != CMD_UNKNOWN && command != CMD_HOST_BAUD) {
+				host_baud_last_valid = millis();
+				host_baud_noise = 0;
+				host_baud_probation = false;
+			}
+			host_baud_in_frame = false;
+		} else if (IN_FRAME) {
+			if (!host_baud_in_frame) { host_baud_in_frame = true; host_baud_frame_start = millis(); }
+		} else if (host_baud_noise < 0xFFFF) {
+			host_baud_noise++;
+		}
+	}
+
+	// Falls back to the default rate if no valid frame has
+	// arrived since switching, or if the link has carried
+	// only noise for a full timeout period, such as when a
+	// new host opens the port at the default rate. A frame
+	// in progress is let finish, unless it has been open
+	// for a whole timeout period, which only garbage does.
+	//
+	// Bench check: negotiate 921600, idle for longer than
+	// HOST_BAUD_TIMEOUT_MS, then send CMD_DETECT and a data
+	// frame. Both must be answered at 921600 with no
+	// revert to the default rate.
+	void host_baud_check() {
+		if (host_baudrate != serial_baudrate && millis()-host_baud_last_valid >= HOST_BAUD_TIMEOUT_MS) {
+			bool stale_frame = host_baud_in_frame && millis()-host_baud_frame_start >= HOST_BAUD_TIMEOUT_MS;
+			if (host_baud_in_frame && !stale_frame) { return; }
+			if (host_baud_probation || host_baud_noise > 0 || stale_frame) { host_baud_set(serial_baudrate); }
+		}
+	}
+#endif
+
 void kiss_indicate_frequency() {
 	serial_write(FEND);
 	serial_write(CMD_FREQUENCY);
@@ -1036,6 +1299,108 @@ void kiss_indicate_temperature() {
 	#endif
 }
 
+#if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+	uint8_t tx_queue_height();
+	uint16_t tx_queued_bytes();
+
+	void tlm_write_header(uint8_t type, uint8_t len) {
+		escaped_serial_write(type);
+		escaped_serial_write(len);
+	}
+
+	// Sends one telemetry frame: a version byte followed
+	// by a type-length-value entry for each subscribed
+	// field. Replies to a subscription request lead with
+	// the active configuration.
+	void kiss_indicate_telemetry(uint8_t p, bool with_config) {
+		serial_write(FEND);
+		serial_write(CMD_TELEMETRY);
+		escaped_serial_write(TLM_VERSION);
+
+		if (with_config) {
+			tlm_write_header(TLM_T_CONFIG, 4);
+			escaped_serial_write(telemetry_fields[p]>>8);   escaped_serial_write(telemetry_fields[p]);
+			escaped_serial_write(telemetry_interval[p]>>8); escaped_serial_write(telemetry_interval[p]);
+		}
+
+		if (telemetry_fields[p] & TLM_FIELD(TLM_CHANNEL_UTIL)) {
+			uint16_t cls = (uint16_t)(total_channel_util*100*100);
+			uint16_t cll = (uint16_t)(longterm_channel_util*100*100);
+			tlm_write_header(TLM_CHANNEL_UTIL, 4);
+			escaped_serial_write(cls>>8); escaped_serial_write(cls);
+			escaped_serial_write(cll>>8); escaped_serial_write(cll);
+		}
+
+		if (telemetry_fields[p] & TLM_FIELD(TLM_AIRTIME)) {
+			uint16_t ats = (uint16_t)(airtime*100*100);
+			uint16_t atl = (uint16_t)(longterm_airtime*100*100);
+			tlm_write_header(TLM_AIRTIME, 4);
+			escaped_serial_write(ats>>8); escaped_serial_write(ats);
+			escaped_serial_write(atl>>8); escaped_serial_write(atl);
+		}
+
+		if (telemetry_fields[p] & TLM_FIELD(TLM_NOISE_FLOOR)) {
+			uint8_t crs = (uint8_t)(current_rssi+rssi_offset);
+			uint8_t nfl = (uint8_t)(noise_floor+rssi_offset);
+			uint8_t ntf = 0xFF; if (interference_detected) { ntf = (uint8_t)(current_rssi+rssi_offset); }
+			tlm_write_header(TLM_NOISE_FLOOR, 3);
+			escaped_serial_write(crs);
+			escaped_serial_write(nfl);
+			escaped_serial_write(ntf);
+		}
+
+		if (telemetry_fields[p] & TLM_FIELD(TLM_QUEUE)) {
+			tlm_write_header(TLM_QUEUE, 3);
+			uint8_t qh = tx_queue_height(); uint16_t qb = tx_queued_bytes();
+			escaped_serial_write(qh);
+			escaped_serial_write(qb>>8); escaped_serial_write(qb);
+		}
+
+		if (telemetry_fields[p] & TLM_FIELD(TLM_BATTERY) && battery_ready) {
+			tlm_write_header(TLM_BATTERY, 2);
+			escaped_serial_write(battery_state);
+			escaped_serial_write((uint8_t)int(battery_percent));
+		}
+
+		#if HAS_PMU && MCU_VARIANT == MCU_ESP32
+			if (telemetry_fields[p] & TLM_FIELD(TLM_TEMPERATURE) && pmu_temp_sensor_ready) {
+				tlm_write_header(TLM_TEMPERATURE, 1);
+				escaped_serial_write((int8_t)(pmu_temperature+PMU_TEMP_OFFSET));
+			}
+		#endif
+
+		if (telemetry_fields[p] & TLM_FIELD(TLM_CSMA)) {
+			tlm_write_header(TLM_CSMA, 3);
+			escaped_serial_write(cw_band);
+			escaped_serial_write(cw_min);
+			escaped_serial_write(cw_max);
+		}
+
+		serial_write(FEND);
+	}
+
+	void update_telemetry() {
+		for (uint8_t p = 0; p < HOST_PORTS; p++) {
+			if (telemetry_subscribed(p) && millis()-last_telemetry[p] >= (uint32_t)telemetry_interval[p]*TLM_INTERVAL_MS) {
+				last_telemetry[p] = millis();
+				if (host_tx_only(1 << p)) { kiss_indicate_telemetry(p, false); }
+				host_tx_all();
+			}
+		}
+	}
+#endif
+
+// Unsolicited status frames only go to hosts without a
+// telemetry subscription. Returns false if there are
+// none, otherwise the caller ends with host_tx_all().
+bool host_tx_unsubscribed() {
+	uint8_t mask = 0x00;
+	for (uint8_t p = 0; p < HOST_PORTS; p++) { if (!telemetry_subscribed(p)) { mask |= 1 << p; } }
+	if (host_tx_only(mask)) { return true; }
+	host_tx_all();
+	return false;
+}
+
 void kiss_indicate_btpin() {
 	#if HAS_BLUETOOTH || HAS_BLE == true
 		serial_write(FEND);
@@ -1048,6 +1413,46 @@ void kiss_indicate_btpin() {
 	#endif
 }
 
+#if MCU_VARIANT == MCU_NRF52 && HAS_BLE
+	void kiss_indicate_bt_profile() {
+		serial_write(FEND);
+		serial_write(CMD_BT_PROFILE);
+		serial_write(bt_profile);
+		serial_write(FEND);
+	}
+
+	void kiss_indicate_ble_probe() {
+		serial_write(FEND);
+		serial_write(CMD_STAT_BLE);
+		serial_write(BLE_RTT_PROBE);
+		serial_write(FEND);
+	}
+
+	void kiss_indicate_ble_stats() {
+		uint16_t mtu = 0; uint8_t phy = 0; uint16_t interval = 0;
+		BLEConnection* conn = Bluefruit.Connection(bt_conn_handle);
+		if (bt_state == BT_STATE_CONNECTED && conn != NULL && conn->connected()) {
+			mtu = conn->getMtu();
+			phy = conn->getPHY();
+			interval = conn->getConnectionInterval();
+		}
+
+		serial_write(FEND);
+		serial_write(CMD_STAT_BLE);
+		serial_write(0xFF);
+		escaped_serial_write(bt_profile);
+		escaped_serial_write(mtu>>8); escaped_serial_write(mtu);
+		escaped_serial_write(phy);
+		escaped_serial_write(interval>>8); escaped_serial_write(interval);
+		escaped_serial_write(bt_tx_rate>>24); escaped_serial_write(bt_tx_rate>>16);
+		escaped_serial_write(bt_tx_rate>>8);  escaped_serial_write(bt_tx_rate);
+		escaped_serial_write(bt_rx_rate>>24); escaped_serial_write(bt_rx_rate>>16);
+		escaped_serial_write(bt_rx_rate>>8);  escaped_serial_write(bt_rx_rate);
+		escaped_serial_write(bt_rtt_ms>>8); escaped_serial_write(bt_rtt_ms);
+		serial_write(FEND);
+	}
+#endif
+
 void kiss_indicate_random(uint8_t byte) {
 	serial_write(FEND);
 	serial_write(CMD_RANDOM);
@@ -1146,14 +1551,125 @@ void kiss_indicate_disp() {
 	#if HAS_DISPLAY
 		uint8_t *da = disp_area.getBuffer();
 		uint8_t *sa = stat_area.getBuffer();
+		display_fb_lock();
 		for (int i = 0; i < 512; i++) { escaped_serial_write(da[i]); }
 		for (int i = 0; i < 512; i++) { escaped_serial_write(sa[i]); }
+		display_fb_unlock();
+	#else
+		serial_write(0xFF);
+	#endif
+	serial_write(FEND);
+}
+
+#if HAS_DISPLAY
+	#define fb_rect_byte(src, x, y, w, i) src[((y)+(i)/(w))*8+(x)+(i)%(w)]
+
+	// Run-length encodes a framebuffer rectangle in the
+	// format accepted by CMD_FB_BULK writes
+	void fb_rle_write(const uint8_t *src, uint8_t x, uint8_t y, uint8_t w, uint8_t h) {
+		uint16_t n = w*h; uint16_t i = 0;
+		while (i < n) {
+			uint8_t byte = fb_rect_byte(src, x, y, w, i); uint16_t run = 1;
+			while (i+run < n && run < 128 && fb_rect_byte(src, x, y, w, i+run) == byte) { run++; }
+			if (run > 1) {
+				escaped_serial_write(0x80 | (run-1));
+				escaped_serial_write(byte);
+				i += run;
+			} else {
+				uint16_t start = i; uint8_t len = 0;
+				while (i < n && len < 128) {
+					if (i+1 < n && fb_rect_byte(src, x, y, w, i) == fb_rect_byte(src, x, y, w, i+1)) { break; }
+					i++; len++;
+				}
+				escaped_serial_write(len-1);
+				for (uint16_t k = start; k < start+len; k++) { escaped_serial_write(fb_rect_byte(src, x, y, w, k)); }
+			}
+		}
+	}
+#endif
+
+void kiss_indicate_fb_bulk(uint8_t op, uint8_t x, uint8_t y, uint8_t w, uint8_t h) {
+	serial_write(FEND);
+	serial_write(CMD_FB_BULK);
+	#if HAS_DISPLAY
+		if (fb_rect_valid(x, y, w, h)) {
+			escaped_serial_write(op | FB_BULK_RLE);
+			escaped_serial_write(x); escaped_serial_write(y);
+			escaped_serial_write(w); escaped_serial_write(h);
+			if (op & FB_BULK_DISP) {
+				display_fb_lock();
+				fb_rle_write(disp_area.getBuffer(), x, y, w, h);
+				fb_rle_write(stat_area.getBuffer(), x, y, w, h);
+				display_fb_unlock();
+			} else {
+				fb_rle_write(fb, x, y, w, h);
+			}
+		} else {
+			serial_write(0xFF);
+		}
 	#else
 		serial_write(0xFF);
 	#endif
 	serial_write(FEND);
 }
 
+void boot_phase(uint8_t phase) {
+	if (boot_phases < BOOT_PHASES_MAX) {
+		boot_phase_ids[boot_phases] = phase;
+		boot_phase_ms[boot_phases] = millis();
+		boot_phases++;
+	}
+}
+
+void kiss_indicate_boot_profile() {
+	serial_write(FEND);
+	serial_write(CMD_BOOT_PROF);
+	escaped_serial_write(boot_phases);
+	for (uint8_t i = 0; i < boot_phases; i++) {
+		escaped_serial_write(boot_phase_ids[i]);
+		escaped_serial_write(boot_phase_ms[i]>>24);
+		escaped_serial_write(boot_phase_ms[i]>>16);
+		escaped_serial_write(boot_phase_ms[i]>>8);
+		escaped_serial_write(boot_phase_ms[i]);
+	}
+	serial_write(FEND);
+}
+
+// Dumps the profiling points as: version, CPU clock in
+// MHz, point count, histogram bin count and shift, then
+// per point its id, call count, total and max cycles,
+// and the histogram bins saturated to 16 bits. Builds
+// without profiling answer with zero points.
+void kiss_indicate_prof_stats() {
+	serial_write(FEND);
+	serial_write(CMD_PROF_STATS);
+	escaped_serial_write(PROF_VERSION);
+	#if HAS_PROF
+		uint16_t mhz = prof_cpu_mhz();
+		escaped_serial_write(mhz>>8); escaped_serial_write(mhz);
+		escaped_serial_write(PROF_POINTS);
+		escaped_serial_write(PROF_HIST_BINS);
+		escaped_serial_write(PROF_HIST_SHIFT);
+		for (uint8_t i = 0; i < PROF_POINTS; i++) {
+			prof_point_t p = prof_points[i];
+			escaped_serial_write(i);
+			for (int8_t b = 24; b >= 0; b -= 8) { escaped_serial_write(p.count>>b); }
+			for (int8_t b = 56; b >= 0; b -= 8) { escaped_serial_write(p.total>>b); }
+			for (int8_t b = 24; b >= 0; b -= 8) { escaped_serial_write(p.max>>b); }
+			for (uint8_t h = 0; h < PROF_HIST_BINS; h++) {
+				uint16_t n = (p.hist[h] > 0xFFFF) ? 0xFFFF : p.hist[h];
+				escaped_serial_write(n>>8); escaped_serial_write(n);
+			}
+		}
+	#else
+		escaped_serial_write(0x00); escaped_serial_write(0x00);
+		escaped_serial_write(0x00);
+		escaped_serial_write(PROF_HIST_BINS);
+		escaped_serial_write(PROF_HIST_SHIFT);
+	#endif
+	serial_write(FEND);
+}
+
 void kiss_indicate_ready() {
 	serial_write(FEND);
 	serial_write(CMD_READY);
@@ -1186,6 +1702,26 @@ void kiss_indicate_detect() {
 	serial_write(FEND);
 }
 
+#if HAS_HOST_MUX
+	void kiss_indicate_mux_chain() {
+		serial_write(FEND);
+		serial_write(CMD_MUX_CHAIN);
+		serial_write(mux_rx_port);
+		serial_write(mux_ports[mux_rx_port].subscribed);
+		serial_write(FEND);
+	}
+
+	void kiss_indicate_mux_ports() {
+		serial_write(FEND);
+		serial_write(CMD_MUX_DSCVR);
+		for (uint8_t p = 0; p < MUX_PORTS; p++) {
+			serial_write(p);
+			serial_write(mux_port_flags(p));
+		}
+		serial_write(FEND);
+	}
+#endif
+
 void kiss_indicate_version() {
 	serial_write(FEND);
 	serial_write(CMD_FW_VERSION);
@@ -1427,32 +1963,53 @@ void promisc_disable() {
 #if !HAS_EEPROM && MCU_VARIANT == MCU_NRF52
   bool eeprom_begin() {
     InternalFS.begin();
+    memset(eeprom_image, 0xFF, EEPROM_SIZE);
 
-    file.open(EEPROM_FILE, FILE_O_READ);
-    if (!file) {
-      if (file.open(EEPROM_FILE, FILE_O_WRITE)) {
-      	for (uint32_t mapped_addr = 0; mapped_addr < EEPROM_SIZE; mapped_addr++) { file.seek(mapped_addr); file.write(0xFF); }
-        eeprom_flush();
-        return true;
-      } else {
-        return false;
-      }
-    } else {
+    // A commit interrupted after the temporary file was
+    // complete but before the rename is finished here
+    if (!InternalFS.exists(EEPROM_FILE) && InternalFS.exists(EEPROM_TMP_FILE)) {
+      InternalFS.rename(EEPROM_TMP_FILE, EEPROM_FILE);
+    }
+
+    if (file.open(EEPROM_FILE, FILE_O_READ)) {
+      file.read(eeprom_image, EEPROM_SIZE);
       file.close();
-      file.open(EEPROM_FILE, FILE_O_WRITE);
       return true;
+    } else {
+      eeprom_dirty = true;
+      eeprom_flush();
+      return !eeprom_dirty;
     }
   }
 
   uint8_t eeprom_read(uint32_t mapped_addr) {
-      uint8_t byte;
-      void* byte_ptr = &byte;
-      file.seek(mapped_addr);
-      file.read(byte_ptr, 1);
-      return byte;
+    if (mapped_addr >= EEPROM_SIZE) return 0xFF;
+    return eeprom_image[mapped_addr];
   }
 #endif
 
+// Writes between eeprom_txn_begin and eeprom_txn_commit
+// are collected and committed to flash together.
+uint8_t eeprom_txn_depth = 0;
+#if MCU_VARIANT == MCU_ESP32
+	bool eeprom_dirty = false;
+#endif
+
+void eeprom_txn_begin() { eeprom_txn_depth++; }
+
+void eeprom_txn_commit() {
+	if (eeprom_txn_depth > 0) eeprom_txn_depth--;
+	if (eeprom_txn_depth == 0) {
+		#if MCU_VARIANT == MCU_ESP32
+			// The EEPROM emulation keeps its image as a single
+			// CRC checked NVS blob, so this is one NVS write.
+			if (eeprom_dirty) { EEPROM.commit(); eeprom_dirty = false; }
+		#elif !HAS_EEPROM && MCU_VARIANT == MCU_NRF52
+			eeprom_flush();
+		#endif
+	}
+}
+
 bool eeprom_info_locked() {
   #if HAS_EEPROM
     uint8_t lock_byte = EEPROM.read(eeprom_addr(ADDR_INFO_LOCK));
@@ -1524,9 +2081,13 @@ void kiss_dump_config() {
 
 #if !HAS_EEPROM && MCU_VARIANT == MCU_NRF52
 void eeprom_flush() {
-    file.close();
-    file.open(EEPROM_FILE, FILE_O_WRITE);
-    written_bytes = 0;
+    if (!eeprom_dirty) return;
+    InternalFS.remove(EEPROM_TMP_FILE);
+    if (file.open(EEPROM_TMP_FILE, FILE_O_WRITE)) {
+      size_t written = file.write(eeprom_image, EEPROM_SIZE);
+      file.close();
+      if (written == EEPROM_SIZE && InternalFS.rename(EEPROM_TMP_FILE, EEPROM_FILE)) { eeprom_dirty = false; }
+    }
 }
 #endif
 
@@ -1536,21 +2097,16 @@ void eeprom_update(int mapped_addr, uint8_t byte) {
 	#elif MCU_VARIANT == MCU_ESP32
 		if (EEPROM.read(mapped_addr) != byte) {
 			EEPROM.write(mapped_addr, byte);
-			EEPROM.commit();
+			eeprom_dirty = true;
 		}
+		if (eeprom_txn_depth == 0 && eeprom_dirty) { EEPROM.commit(); eeprom_dirty = false; }
   #elif !HAS_EEPROM && MCU_VARIANT == MCU_NRF52
-    // todo: clean up this implementation, writing one byte and syncing
-    // each time is really slow, but this is also suboptimal
-    uint8_t read_byte;
-    void* read_byte_ptr = &read_byte;
-    file.seek(mapped_addr);
-    file.read(read_byte_ptr, 1);
-    file.seek(mapped_addr);
-    if (read_byte != byte) {
-      file.write(byte);
+    if (mapped_addr < 0 || mapped_addr >= EEPROM_SIZE) return;
+    if (eeprom_image[mapped_addr] != byte) {
+      eeprom_image[mapped_addr] = byte;
+      eeprom_dirty = true;
     }
-    written_bytes++;
-    eeprom_flush();
+    if (eeprom_txn_depth == 0) eeprom_flush();
 	#endif
 }
 
@@ -1566,9 +2122,11 @@ void eeprom_erase() {
 	#if !HAS_EEPROM && MCU_VARIANT == MCU_NRF52
 		InternalFS.format();
 	#else
+		eeprom_txn_begin();
 		for (int addr = 0; addr < EEPROM_RESERVED; addr++) {
 			eeprom_update(eeprom_addr(addr), 0xFF);
 		}
+		eeprom_txn_commit();
 	#endif
 	hard_reset();
 }
@@ -1707,28 +2265,23 @@ bool eeprom_checksum_valid() {
 
 void wr_conf_save(uint8_t mode) {
 	eeprom_update(eeprom_addr(ADDR_CONF_WIFI), mode);
-  #if !HAS_EEPROM && MCU_VARIANT == MCU_NRF52
-    // have to do a flush because we're only writing 1 byte and it syncs after 8
-    eeprom_flush();
-  #endif
 }
 
 void bt_conf_save(bool is_enabled) {
 	if (is_enabled) {
 		eeprom_update(eeprom_addr(ADDR_CONF_BT), BT_ENABLE_BYTE);
-      #if !HAS_EEPROM && MCU_VARIANT == MCU_NRF52
-        // have to do a flush because we're only writing 1 byte and it syncs after 8
-        eeprom_flush();
-      #endif
 	} else {
 		eeprom_update(eeprom_addr(ADDR_CONF_BT), 0x00);
-    #if !HAS_EEPROM && MCU_VARIANT == MCU_NRF52
-      // have to do a flush because we're only writing 1 byte and it syncs after 8
-      eeprom_flush();
-    #endif
 	}
 }
 
+#if MCU_VARIANT == MCU_NRF52 && HAS_BLE
+	void bt_profile_save(uint8_t profile) {
+		bt_profile = profile;
+		eeprom_update(eeprom_addr(ADDR_CONF_BTP), profile);
+	}
+#endif
+
 void di_conf_save(uint8_t dint) {
 	eeprom_update(eeprom_addr(ADDR_CONF_DINT), dint);
 }
@@ -1745,8 +2298,10 @@ void db_conf_save(uint8_t val) {
 			display_blanking_enabled = true;
 			display_blanking_timeout = val*1000;
 		}
+		eeprom_txn_begin();
 		eeprom_update(eeprom_addr(ADDR_CONF_BSET), CONF_OK_BYTE);
 		eeprom_update(eeprom_addr(ADDR_CONF_DBLK), val);
+		eeprom_txn_commit();
 	#endif
 }
 
@@ -1766,8 +2321,10 @@ void dia_conf_save(uint8_t val) {
 }
 
 void np_int_conf_save(uint8_t p_int) {
+	eeprom_txn_begin();
 	eeprom_update(eeprom_addr(ADDR_CONF_PSET), CONF_OK_BYTE);
 	eeprom_update(eeprom_addr(ADDR_CONF_PINT), p_int);
+	eeprom_txn_commit();
 }
 
 
@@ -1803,6 +2360,7 @@ void eeprom_conf_load() {
 
 void eeprom_conf_save() {
 	if (hw_ready && radio_online) {
+		eeprom_txn_begin();
 		eeprom_update(eeprom_addr(ADDR_CONF_SF), lora_sf);
 		eeprom_update(eeprom_addr(ADDR_CONF_CR), lora_cr);
 		eeprom_update(eeprom_addr(ADDR_CONF_TXP), lora_txp);
@@ -1818,6 +2376,7 @@ void eeprom_conf_save() {
 		eeprom_update(eeprom_addr(ADDR_CONF_FREQ)+0x03, lora_freq);
 
 		eeprom_update(eeprom_addr(ADDR_CONF_OK), CONF_OK_BYTE);
+		eeprom_txn_commit();
 		led_indicate_info(10);
 	} else {
 		led_indicate_warning(10);
@@ -1845,6 +2404,120 @@ void init_channel_stats() {
 	#endif
 }
 
+#if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+	// Channel estimators preserved across warm restarts.
+	// The block lives in memory that is not cleared on
+	// reset, and is only trusted if the magic, version
+	// and CRC all match. It is refreshed whenever the
+	// airtime bin advances, and right before a reset.
+	#define WARM_STATE_MAGIC   0x524E5753
+	#define WARM_STATE_VERSION 0x01
+
+	typedef struct {
+		uint32_t magic;
+		uint8_t  version;
+		uint8_t  cw_band;
+		uint8_t  noise_floor_sampled;
+		uint8_t  reserved;
+		int32_t  noise_floor;
+		uint16_t noise_floor_sample;
+		uint16_t airtime_bin;
+		uint32_t lora_freq;
+		uint32_t lora_bw;
+		int32_t  noise_floor_buffer[NOISE_FLOOR_SAMPLES];
+		uint16_t airtime_bins[AIRTIME_BINS];
+		float    longterm_bins[AIRTIME_BINS];
+		uint32_t crc;
+	} warm_state_t;
+
+	#if MCU_VARIANT == MCU_ESP32
+		RTC_NOINIT_ATTR warm_state_t warm_state;
+	#else
+		warm_state_t warm_state __attribute__ ((section(".noinit")));
+	#endif
+
+	bool warm_state_restored = false;
+	uint16_t warm_state_bin = 0xFFFF;
+
+	uint32_t warm_state_crc() {
+		const uint8_t *p = (const uint8_t*)&warm_state;
+		uint32_t crc = 0xFFFFFFFF;
+		for (size_t i = 0; i < offsetof(warm_state_t, crc); i++) {
+			crc ^= p[i];
+			for (uint8_t b = 0; b < 8; b++) { crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1)); }
+		}
+		return ~crc;
+	}
+
+	void warm_state_save() {
+		// Until the saved state has been consumed, the
+		// live estimators are empty and must not replace it
+		if (!warm_state_restored) { return; }
+		warm_state.magic = WARM_STATE_MAGIC;
+		warm_state.version = WARM_STATE_VERSION;
+		warm_state.cw_band = cw_band;
+		warm_state.noise_floor_sampled = noise_floor_sampled;
+		warm_state.reserved = 0x00;
+		warm_state.noise_floor = noise_floor;
+		warm_state.noise_floor_sample = noise_floor_sample;
+		warm_state.airtime_bin = current_airtime_bin();
+		warm_state.lora_freq = lora_freq;
+		warm_state.lora_bw = lora_bw;
+		for (uint8_t i = 0; i < NOISE_FLOOR_SAMPLES; i++) { warm_state.noise_floor_buffer[i] = noise_floor_buffer[i]; }
+		memcpy(warm_state.airtime_bins, airtime_bins, sizeof(airtime_bins));
+		memcpy(warm_state.longterm_bins, longterm_bins, sizeof(longterm_bins));
+		warm_state.crc = warm_state_crc();
+	}
+
+	void warm_state_update() {
+		uint16_t cb = current_airtime_bin();
+		if (cb != warm_state_bin) { warm_state_bin = cb; warm_state_save(); }
+	}
+
+	bool warm_state_valid() {
+		#if MCU_VARIANT == MCU_ESP32
+			// RTC memory is also kept through deep sleep,
+			// but the estimators are stale after waking.
+			if (esp_reset_reason() == ESP_RST_DEEPSLEEP) { return false; }
+		#endif
+		if (warm_state.magic != WARM_STATE_MAGIC) { return false; }
+		if (warm_state.version != WARM_STATE_VERSION) { return false; }
+		if (warm_state.cw_band < 1 || warm_state.cw_band > CSMA_CW_BANDS) { return false; }
+		return warm_state.crc == warm_state_crc();
+	}
+
+	// Restores the saved estimators once per boot. Must
+	// run after init_channel_stats(), since that clears
+	// the airtime bins. The saved bins are rotated so
+	// that the bin that was current at save time maps
+	// to the current bin of the new millis() timebase.
+	void warm_state_restore() {
+		if (warm_state_restored) { return; }
+		warm_state_restored = true;
+		if (!warm_state_valid()) { warm_state.magic = 0x00; return; }
+
+		uint16_t cb = current_airtime_bin();
+		for (uint16_t ai = 0; ai < AIRTIME_BINS; ai++) {
+			uint16_t ni = (ai + AIRTIME_BINS - warm_state.airtime_bin + cb) % AIRTIME_BINS;
+			airtime_bins[ni] = warm_state.airtime_bins[ai];
+			longterm_bins[ni] = warm_state.longterm_bins[ai];
+		}
+
+		cw_band = warm_state.cw_band;
+		cw_min  = (cw_band-1) * CSMA_CW_PER_BAND_WINDOWS;
+		cw_max  = (cw_band) * CSMA_CW_PER_BAND_WINDOWS - 1;
+
+		// The noise floor only carries over if the radio
+		// came back up on the same channel.
+		if (warm_state.lora_freq == lora_freq && warm_state.lora_bw == lora_bw) {
+			for (uint8_t i = 0; i < NOISE_FLOOR_SAMPLES; i++) { noise_floor_buffer[i] = warm_state.noise_floor_buffer[i]; }
+			noise_floor_sample = warm_state.noise_floor_sample % NOISE_FLOOR_SAMPLES;
+			noise_floor_sampled = warm_state.noise_floor_sampled;
+			noise_floor = warm_state.noise_floor;
+		}
+	}
+#endif
+
 typedef struct FIFOBuffer
 {
   unsigned char *begin;
@@ -1884,6 +2557,37 @@ inline void fifo_flush(FIFOBuffer *f) {
   f->head = f->tail;
 }
 
+// Returns the number of bytes that can be written
+// contiguously from the current tail of the FIFO,
+// and points region at the first free byte. Once
+// data has been written, fifo_commit must be called
+// to make the bytes available to the reader.
+inline size_t fifo_free_region(FIFOBuffer *f, unsigned char **region) {
+  unsigned char *head = f->head;
+  *region = f->tail;
+  if (f->tail >= head) {
+    size_t span = f->end - f->tail + 1;
+    if (head == f->begin) { span--; }
+    return span;
+  } else {
+    return head - f->tail - 1;
+  }
+}
+
+inline void fifo_commit(FIFOBuffer *f, size_t len) {
+  unsigned char *tail = f->tail + len;
+  if (tail > f->end) { tail = f->begin; }
+  f->tail = tail;
+}
+
+inline size_t fifo_free_space(const FIFOBuffer *f) {
+  unsigned char *head = f->head;
+  size_t used;
+  if (f->tail >= head) { used = f->tail - head; }
+  else                 { used = (f->end - f->begin + 1) - (head - f->tail); }
+  return (f->end - f->begin) - used;
+}
+
 #if MCU_VARIANT != MCU_ESP32 && MCU_VARIANT != MCU_NRF52
 	static inline bool fifo_isempty_locked(const FIFOBuffer *f) {
 	  bool result;
@@ -2011,6 +2715,150 @@ inline uint16_t fifo16_len(FIFOBuffer16 *f) {
   return (f->end - f->begin);
 }
 
+// Single producer, single consumer ring of packet
+// descriptors over a circular byte buffer. The host
+// side stages bytes and commits them as a descriptor,
+// the transmit side peeks, copies out and releases it.
+// Each index has exactly one writer, so neither side
+// needs a lock, and the queue height and byte count
+// are derived from the indices instead of counted.
+#define PKT_FLAG_SPLIT 0x01
+
+#if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+  #define PKT_RING_FENCE() __sync_synchronize()
+#else
+  #define PKT_RING_FENCE() __asm__ __volatile__ ("" ::: "memory")
+#endif
+
+// On AVR a descriptor is kept to the 4 bytes per slot
+// that the old start and length FIFOs used, so it has
+// no enqueue timestamp and the flags share the length.
+#if MCU_VARIANT == MCU_ESP32 || MCU_VARIANT == MCU_NRF52
+  #define PKT_DESC_TIMESTAMP true
+#else
+  #define PKT_DESC_TIMESTAMP false
+#endif
+
+typedef struct PacketDesc
+{
+  uint16_t offset;
+  #if PKT_DESC_TIMESTAMP
+    uint16_t length;
+    uint8_t  flags;
+    uint32_t enqueued_us;
+  #else
+    uint16_t length : 15;
+    uint16_t flags  : 1;
+  #endif
+} PacketDesc;
+
+typedef struct PacketRing
+{
+  PacketDesc *desc;
+  uint8_t *data;
+  uint16_t size;
+  uint8_t  slots;
+  volatile uint8_t  head;     // Written by the producer
+  volatile uint8_t  tail;     // Written by the consumer
+  volatile uint16_t cursor;   // Written by the producer
+  volatile uint16_t released; // Written by the consumer
+  uint16_t start;
+  bool dropped;
+} PacketRing;
+
+inline void pkt_ring_init(PacketRing *r, PacketDesc *desc, uint8_t slots, uint8_t *data, uint16_t size) {
+  r->desc = desc; r->slots = slots;
+  r->data = data; r->size  = size;
+  r->head = r->tail = 0;
+  r->cursor = r->released = r->start = 0;
+  r->dropped = false;
+}
+
+inline uint8_t pkt_ring_height(const PacketRing *r) {
+  uint8_t h = r->head; uint8_t t = r->tail;
+  return (h >= t) ? h - t : r->slots - t + h;
+}
+
+inline bool pkt_ring_isempty(const PacketRing *r) { return r->head == r->tail; }
+
+inline bool pkt_ring_isfull(const PacketRing *r) {
+  uint8_t next = r->head+1; if (next == r->slots) { next = 0; }
+  return next == r->tail;
+}
+
+// Bytes held by queued and staged packets. One byte is
+// always left free, so a full buffer is never mistaken
+// for an empty one.
+inline uint16_t pkt_ring_used(const PacketRing *r) {
+  uint16_t c, rl;
+  #if MCU_VARIANT != MCU_ESP32 && MCU_VARIANT != MCU_NRF52
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { c = r->cursor; rl = r->released; }
+  #else
+    c = r->cursor; rl = r->released;
+  #endif
+  return (c >= rl) ? c - rl : r->size - rl + c;
+}
+
+inline uint16_t pkt_ring_free(const PacketRing *r) { return r->size - 1 - pkt_ring_used(r); }
+
+inline uint16_t pkt_ring_staged(const PacketRing *r) {
+  uint16_t c = r->cursor;
+  return (c >= r->start) ? c - r->start : r->size - r->start + c;
+}
+
+// Producer side
+inline bool pkt_ring_stage(PacketRing *r, uint8_t b) {
+  if (r->dropped || pkt_ring_isfull(r) || pkt_ring_free(r) == 0) { r->dropped = true; return false; }
+  uint16_t c = r->cursor;
+  r->data[c++] = b; if (c == r->size) { c = 0; }
+  r->cursor = c;
+  return true;
+}
+
+inline void pkt_ring_discard(PacketRing *r) {
+  r->cursor = r->start;
+  r->dropped = false;
+}
+
+inline bool pkt_ring_commit(PacketRing *r, uint8_t flags) {
+  if (r->dropped || pkt_ring_isfull(r)) { pkt_ring_discard(r); return false; }
+  PacketDesc *d = &r->desc[r->head];
+  d->offset = r->start;
+  d->length = pkt_ring_staged(r);
+  d->flags = flags & PKT_FLAG_SPLIT;
+  #if PKT_DESC_TIMESTAMP
+    d->enqueued_us = micros();
+  #endif
+  PKT_RING_FENCE();
+  uint8_t next = r->head+1; if (next == r->slots) { next = 0; }
+  r->head = next;
+  r->start = r->cursor;
+  return true;
+}
+
+// Consumer side
+inline PacketDesc *pkt_ring_peek(PacketRing *r) {
+  if (pkt_ring_isempty(r)) { return NULL; }
+  PKT_RING_FENCE();
+  return &r->desc[r->tail];
+}
+
+inline void pkt_ring_read(const PacketRing *r, const PacketDesc *d, uint8_t *buf) {
+  uint16_t pos = d->offset;
+  for (uint16_t i = 0; i < d->length; i++) {
+    buf[i] = r->data[pos++]; if (pos == r->size) { pos = 0; }
+  }
+}
+
+inline void pkt_ring_release(PacketRing *r) {
+  const PacketDesc *d = &r->desc[r->tail];
+  uint16_t end = d->offset + d->length; if (end >= r->size) { end -= r->size; }
+  PKT_RING_FENCE();
+  r->released = end;
+  uint8_t next = r->tail+1; if (next == r->slots) { next = 0; }
+  r->tail = next;
+}
+
 extern void stopRadio();
 void host_disconnected() {
 	stopRadio();